@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "atoms.h"
+#include "ducastelle.h"
+#include "neighbors.h"
+#include "spatial_sort.h"
+#include "xyz.h"
+
+/*
+ * Energy and forces of the gold cluster with 3871 atoms. Run as
+ *     ./benchmark_ducastelle
+ * from a directory that contains `cluster_3871.xyz`.
+ */
+static constexpr double cutoff{5.0};
+
+template <NeighborList::Storage storage>
+static void BM_Ducastelle_scalar(benchmark::State &state) {
+    auto [names, positions]{read_xyz("cluster_3871.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list(storage);
+    neighbor_list.update(atoms, cutoff);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ducastelle(atoms, neighbor_list, cutoff));
+    }
+    state.SetItemsProcessed(state.iterations() * atoms.nb_atoms());
+}
+
+template <NeighborList::Storage storage>
+static void BM_Ducastelle_vectorized(benchmark::State &state) {
+    auto [names, positions]{read_xyz("cluster_3871.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list(storage);
+    neighbor_list.update(atoms, cutoff);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ducastelle_vectorized(atoms, neighbor_list, cutoff));
+    }
+    state.SetItemsProcessed(state.iterations() * atoms.nb_atoms());
+}
+
+template <NeighborList::Storage storage>
+static void BM_Ducastelle_mixed_precision(benchmark::State &state) {
+    auto [names, positions]{read_xyz("cluster_3871.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list(storage);
+    neighbor_list.update(atoms, cutoff);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ducastelle_mixed_precision(atoms, neighbor_list, cutoff));
+    }
+    state.SetItemsProcessed(state.iterations() * atoms.nb_atoms());
+}
+
+/*
+ * Thread schedules on the full list; run with different OMP_NUM_THREADS to
+ * find the fastest schedule for a machine
+ */
+template <ThreadSchedule schedule>
+static void BM_Ducastelle_schedule(benchmark::State &state) {
+    auto [names, positions]{read_xyz("cluster_3871.xyz")};
+    Atoms atoms{names, positions};
+    sort_atoms(atoms, cutoff);
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036,
+                                            4.079 / sqrt(2), schedule));
+    }
+    state.SetItemsProcessed(state.iterations() * atoms.nb_atoms());
+}
+
+BENCHMARK_TEMPLATE(BM_Ducastelle_scalar, NeighborList::Storage::full);
+BENCHMARK_TEMPLATE(BM_Ducastelle_vectorized, NeighborList::Storage::full);
+BENCHMARK_TEMPLATE(BM_Ducastelle_mixed_precision, NeighborList::Storage::full);
+BENCHMARK_TEMPLATE(BM_Ducastelle_scalar, NeighborList::Storage::half);
+BENCHMARK_TEMPLATE(BM_Ducastelle_vectorized, NeighborList::Storage::half);
+BENCHMARK_TEMPLATE(BM_Ducastelle_mixed_precision, NeighborList::Storage::half);
+BENCHMARK_TEMPLATE(BM_Ducastelle_schedule, ThreadSchedule::buffers);
+BENCHMARK_TEMPLATE(BM_Ducastelle_schedule, ThreadSchedule::coloring);
+BENCHMARK_TEMPLATE(BM_Ducastelle_schedule, ThreadSchedule::gather);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <numeric>
+
+#include "cluster_pair_list.h"
+#include "spatial_sort.h"
+
+template <int N>
+const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+ClusterPairList<N>::update(const Atoms &atoms, double cutoff) {
+    if (cutoff <= 0) {
+        throw std::runtime_error("Cutoff must be positive.");
+    }
+
+    const Eigen::Index nb_atoms{atoms.nb_atoms()};
+    const int nb_clusters{static_cast<int>((nb_atoms + N - 1) / N)};
+
+    // Without atoms there are no clusters and no cluster pairs. (The neighbor
+    // list of the cluster centers would not even have seeds.)
+    if (nb_clusters == 0) {
+        cluster_atoms_.resize(0);
+        seed_.setZero(1);
+        neighbors_.resize(0);
+        return {seed_, neighbors_};
+    }
+
+    // Consecutive atoms along a Morton curve are close in space. The cell size
+    // of the curve is chosen smaller than the nearest neighbor distance of
+    // typical systems, such that chunks of N atoms along the curve are
+    // compact.
+    Eigen::ArrayXi order{morton_order(atoms.positions, cutoff / 4)};
+    cluster_atoms_.setConstant(N * nb_clusters, -1);
+    cluster_atoms_.head(nb_atoms) = order;
+
+    // Bounding boxes of all clusters
+    Eigen::Array3Xd lower(3, nb_clusters), upper(3, nb_clusters);
+    for (int I{0}; I < nb_clusters; ++I) {
+        lower.col(I) = atoms.positions.col(cluster_atoms_(N * I));
+        upper.col(I) = lower.col(I);
+        for (int k{1}; k < N; ++k) {
+            const int i{cluster_atoms_(N * I + k)};
+            if (i >= 0) {
+                lower.col(I) = lower.col(I).min(atoms.positions.col(i));
+                upper.col(I) = upper.col(I).max(atoms.positions.col(i));
+            }
+        }
+    }
+
+    // Candidate cluster pairs are those whose centers are within the cutoff
+    // plus the largest extent of any bounding box. These are found with a
+    // neighbor list of the cluster centers.
+    Atoms centers{Positions_t{(lower + upper) / 2}};
+    const double max_diagonal{nb_clusters > 0 ? (upper - lower).matrix().colwise().norm().maxCoeff() : 0.0};
+    NeighborList center_list;
+    center_list.update(centers, cutoff + max_diagonal);
+
+    // Keep only pairs whose bounding boxes are within the cutoff
+    const double cutoff_sq{cutoff * cutoff};
+    Eigen::ArrayXi nb_neighbors_per_cluster{Eigen::ArrayXi::Ones(nb_clusters)};  // self pair
+    std::vector<int> pairs;
+    pairs.reserve(center_list.nb_neighbors());
+    center_list.for_each_pair([&](int I, int J) {
+        const Eigen::Array3d gap{(lower.col(J) - upper.col(I)).max(lower.col(I) - upper.col(J)).max(0)};
+        if (gap.square().sum() < cutoff_sq) {
+            nb_neighbors_per_cluster(I)++;
+            pairs.push_back(I);
+            pairs.push_back(J);
+        }
+    });
+
+    // Build CSR arrays; pairs of a full list are visited row by row with
+    // J > I, hence they are already sorted by I
+    seed_.resize(nb_clusters + 1);
+    seed_(0) = 0;
+    std::partial_sum(nb_neighbors_per_cluster.begin(), nb_neighbors_per_cluster.end(), seed_.begin() + 1);
+    neighbors_.resize(seed_(nb_clusters));
+    for (int I{0}, n{0}, p{0}; I < nb_clusters; ++I) {
+        neighbors_(n++) = I;
+        for (; p < static_cast<int>(pairs.size()) && pairs[p] == I; p += 2) {
+            neighbors_(n++) = pairs[p + 1];
+        }
+    }
+
+    return {seed_, neighbors_};
+}
+
+template <int N>
+typename ClusterPairList<N>::ClusterPositions_t ClusterPairList<N>::gather(const Positions_t &positions) const {
+    // Padding atoms are put on the x-axis, separated by a huge distance
+    constexpr double far_away{1e100};
+    ClusterPositions_t cluster_positions(N, 3 * nb_clusters());
+    for (int I{0}; I < nb_clusters(); ++I) {
+        for (int k{0}; k < N; ++k) {
+            const int i{cluster_atoms_(N * I + k)};
+            if (i >= 0) {
+                for (int dim{0}; dim < 3; ++dim) {
+                    cluster_positions(k, 3 * I + dim) = positions(dim, i);
+                }
+            } else {
+                cluster_positions(k, 3 * I) = far_away * (k + 1);
+                cluster_positions(k, 3 * I + 1) = 0;
+                cluster_positions(k, 3 * I + 2) = 0;
+            }
+        }
+    }
+    return cluster_positions;
+}
+
+template class ClusterPairList<4>;
+template class ClusterPairList<8>;
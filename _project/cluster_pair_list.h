@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_CLUSTER_PAIR_LIST_H
+#define YAMD_CLUSTER_PAIR_LIST_H
+
+#include "atoms.h"
+#include "neighbors.h"
+
+/*
+ * Neighbor list between clusters of `N` atoms. Atoms are grouped into
+ * spatially compact clusters of N atoms each (the last cluster is padded with
+ * dummy atoms) and the list stores all pairs of clusters (I, J) with J >= I
+ * whose bounding boxes are closer than the cutoff. A potential then computes
+ * a full NxN block of distances per cluster pair, which maps onto SIMD
+ * instructions, rather than visiting one neighbor j at a time. Note that
+ * not all atoms in a cluster pair are within the cutoff; the potential needs
+ * to mask atom pairs by distance. Typical cluster sizes are 4 and 8.
+ */
+template <int N>
+class ClusterPairList {
+  public:
+    static constexpr int cluster_size{N};
+
+    // Coordinates of a set of clusters in structure-of-arrays layout: column
+    // `3 * I + dim` holds the Cartesian component `dim` of all atoms in
+    // cluster `I`
+    using ClusterPositions_t = Eigen::Array<double, N, Eigen::Dynamic>;
+
+    /*
+     * Group atoms into clusters and compute cluster pairs within `cutoff`.
+     * Returns seed and neighbor arrays of the cluster pairs, which have the
+     * same layout as those of `NeighborList`.
+     */
+    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &> update(const Atoms &atoms, double cutoff);
+
+    /*
+     * Return the number of clusters
+     */
+    int nb_clusters() const { return cluster_atoms_.size() / N; }
+
+    /*
+     * Return the indices of the atoms in cluster `I`. Padding atoms have
+     * index -1.
+     */
+    auto cluster_atoms(int I) const { return cluster_atoms_.template segment<N>(N * I); }
+
+    /*
+     * Gather positions of all atoms into cluster order. Padding atoms are
+     * placed far away from all other atoms and from each other, hence they
+     * never come within the cutoff of any atom.
+     */
+    ClusterPositions_t gather(const Positions_t &positions) const;
+
+    /*
+     * Return the total number of cluster pairs, including the self pairs
+     * (I, I)
+     */
+    int nb_cluster_pairs() const { return seed_(seed_.size() - 1); }
+
+    /*
+     * Iterate over cluster pairs (I, J) with J >= I. Use as
+     *     for (auto [I, J] : cluster_pair_list) { ... }
+     */
+    NeighborList::iterator begin() const {
+        if (seed_.size() > 0) {
+            return NeighborList::iterator(seed_, neighbors_, 0, 0);
+        } else {
+            throw std::runtime_error("Cluster pair list not yet computed. Use `update` to compute it.");
+        }
+    }
+
+    NeighborList::iterator end() const {
+        if (seed_.size() > 0) {
+            return NeighborList::iterator(seed_, neighbors_, seed_.size() - 2, nb_cluster_pairs());
+        } else {
+            throw std::runtime_error("Cluster pair list not yet computed. Use `update` to compute it.");
+        }
+    }
+
+  protected:
+    // Atom indices of all clusters, N consecutive entries per cluster
+    Eigen::ArrayXi cluster_atoms_;
+
+    // Cluster pairs
+    Eigen::ArrayXi seed_;
+    Eigen::ArrayXi neighbors_;
+};
+
+#endif // YAMD_CLUSTER_PAIR_LIST_H
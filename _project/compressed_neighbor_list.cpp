@@ -0,0 +1,54 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compressed_neighbor_list.h"
+
+void CompressedNeighborList::compress() {
+    const int nb_atoms{static_cast<int>(builder_.seed_.size()) - 1};
+    seed_.resize(std::max(nb_atoms, 0) + 1);
+    seed_(0) = 0;
+    data_.clear();
+
+    // The builder has no seeds at all if there are no atoms
+    if (nb_atoms <= 0)
+        return;
+
+    data_.reserve(builder_.nb_neighbors());
+    for (int i{0}; i < nb_atoms; ++i) {
+        for (int j : builder_.neighbors(i)) {
+            int delta{j - i};
+            if (delta > INT16_MIN && delta <= INT16_MAX) {
+                data_.push_back(static_cast<int16_t>(delta));
+            } else {
+                data_.push_back(escape);
+                data_.push_back(static_cast<int16_t>(j & 0xffff));
+                data_.push_back(static_cast<int16_t>(j >> 16));
+            }
+        }
+        seed_(i + 1) = data_.size();
+    }
+
+    // The uncompressed indices are no longer needed
+    builder_.neighbors_.resize(0);
+}
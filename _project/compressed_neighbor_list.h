@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_COMPRESSED_NEIGHBOR_LIST_H
+#define YAMD_COMPRESSED_NEIGHBOR_LIST_H
+
+#include <cstdint>
+#include <vector>
+
+#include "atoms.h"
+#include "neighbors.h"
+
+/*
+ * Neighbor list that stores neighbor indices in compressed form. Each
+ * neighbor j of atom i is stored as a 16-bit difference j - i. Neighbors that
+ * are too far away in index space are stored as an escape marker followed by
+ * the full 32-bit index. If atoms are sorted spatially (see `sort_atoms`),
+ * almost all differences fit into 16 bits and the list needs about half of
+ * the memory (bandwidth) of a `NeighborList`.
+ *
+ * The list is built by a `NeighborList` and compressed afterwards; the
+ * methods mirror those of `NeighborList`.
+ */
+class CompressedNeighborList {
+  public:
+    explicit CompressedNeighborList(NeighborList::Storage storage = NeighborList::Storage::full,
+                                    int bins_per_cutoff = 2)
+        : builder_{storage, bins_per_cutoff}, seed_{1} {
+        seed_(0) = 0;
+    }
+
+    /*
+     * Update the neighbor list, see the corresponding methods of
+     * `NeighborList`
+     */
+    void update(const Atoms &atoms, double cutoff, double skin = 0.0) {
+        builder_.update(atoms, cutoff, skin);
+        compress();
+    }
+
+    void update(const Atoms &atoms, double cutoff, const Eigen::Array3d &domain_length,
+                const Eigen::Array3i &periodicity, double skin = 0.0) {
+        builder_.update(atoms, cutoff, domain_length, periodicity, skin);
+        compress();
+    }
+
+    void update(const Atoms &atoms, double cutoff, double skin, int nb_local, int nb_ghost_shells = 1) {
+        builder_.update(atoms, cutoff, skin, nb_local, nb_ghost_shells);
+        compress();
+    }
+
+    bool is_half() const { return builder_.is_half(); }
+
+    bool is_pair_entry(int i, int j) const { return builder_.is_pair_entry(i, j); }
+
+    Eigen::Array3d minimum_image(const Eigen::Array3d &distance_vector) const {
+        return builder_.minimum_image(distance_vector);
+    }
+
+    Eigen::Vector3d distance_vector(const Positions_t &positions, int i, int j) const {
+        return builder_.distance_vector(positions, i, j);
+    }
+
+    /*
+     * Return the total number of neighbors
+     */
+    int nb_neighbors() const { return seed_.size() > 1 ? builder_.nb_neighbors() : 0; }
+
+    /*
+     * Return the size of the compressed neighbor indices in bytes
+     */
+    std::size_t nb_bytes() const { return data_.size() * sizeof(int16_t); }
+
+    /*
+     * Range over the neighbors of a single atom that decodes the indices on
+     * the fly
+     */
+    class row_range {
+      public:
+        class iterator {
+          public:
+            iterator(const int16_t *data, int i) : data_{data}, i_{i} {}
+
+            int operator*() const {
+                if (*data_ != escape) {
+                    return i_ + *data_;
+                }
+                return static_cast<int>(static_cast<uint16_t>(data_[1]) |
+                                        static_cast<uint32_t>(static_cast<uint16_t>(data_[2])) << 16);
+            }
+
+            iterator &operator++() {
+                data_ += *data_ == escape ? 3 : 1;
+                return *this;
+            }
+
+            bool operator!=(const iterator &other) const { return data_ != other.data_; }
+
+          protected:
+            const int16_t *data_;
+            int i_;
+        };
+
+        row_range(const int16_t *begin, const int16_t *end, int i) : begin_{begin}, end_{end}, i_{i} {}
+
+        iterator begin() const { return {begin_, i_}; }
+
+        iterator end() const { return {end_, i_}; }
+
+      protected:
+        const int16_t *begin_, *end_;
+        int i_;
+    };
+
+    /*
+     * Return the neighbors of atom `i`. Use as
+     *     for (int j : neighbor_list.neighbors(i)) { ... }
+     */
+    row_range neighbors(int i) const {
+        assert(i >= 0);
+        assert(i < seed_.size() - 1);
+        return {data_.data() + seed_(i), data_.data() + seed_(i + 1), i};
+    }
+
+    /*
+     * Call `kernel(i, j)` exactly once for every pair of neighbors, see
+     * `NeighborList::for_each_pair`
+     */
+    template <typename Kernel>
+    void for_each_pair(Kernel &&kernel) const {
+        for (int i{0}; i < seed_.size() - 1; ++i) {
+            for (int j : neighbors(i)) {
+                if (is_pair_entry(i, j)) {
+                    kernel(i, j);
+                }
+            }
+        }
+    }
+
+    // Marker for a neighbor index that does not fit into 16 bits
+    static constexpr int16_t escape{INT16_MIN};
+
+  protected:
+    // Encode the neighbors of the builder and release its memory
+    void compress();
+
+    NeighborList builder_;
+
+    // Neighbors of atom i are stored between seed_(i) and seed_(i + 1)
+    Eigen::ArrayXi seed_;
+    std::vector<int16_t> data_;
+};
+
+#endif // YAMD_COMPRESSED_NEIGHBOR_LIST_H
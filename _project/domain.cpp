@@ -27,6 +27,7 @@
 
 #include "domain.h"
 #include "mpi_support.h"
+#include "spatial_sort.h"
 
 Domain::Domain(const MPI_Comm &comm, const Eigen::Array3d &domain_length,
                const Eigen::Array3i &decomposition,
@@ -75,6 +76,10 @@ void Domain::enable(Atoms &atoms) {
     // This only works if decomposition is disabled.
     assert_disabled();
 
+    // Types are communicated along with the atoms
+    if (atoms.types.size() != static_cast<Eigen::Index>(atoms.nb_atoms()))
+        throw std::runtime_error("Expected one type per atom.");
+
     // Make a copy of the full atoms object.
     Atoms global_atoms{atoms};
 
@@ -87,6 +92,7 @@ void Domain::enable(Atoms &atoms) {
             // This atom resides in the local domain. We need to add it to the
             // domain-local atoms array.
             atoms.masses(local_index) = global_atoms.masses(global_index);
+            atoms.types(local_index) = global_atoms.types(global_index);
             atoms.positions.col(local_index) =
                 global_atoms.positions.col(global_index);
             atoms.velocities.col(local_index) =
@@ -102,6 +108,7 @@ void Domain::enable(Atoms &atoms) {
     // Resize atoms object to fit all process-local atoms.
     atoms.resize(local_index);
     nb_local_ = atoms.nb_atoms();
+    ghost_transfers_.clear();
 
     is_enabled_ = true;
 }
@@ -128,11 +135,14 @@ void Domain::disable(Atoms &atoms) {
     for (int i = 0; i < size_ - 1; i++)
         displ(i + 1) = displ(i) + recvcount(i);
 
-    // Gather masses, positions, velocities and forces into their respective
-    // arrays.
+    // Gather masses, types, positions, velocities and forces into their
+    // respective arrays.
     MPI_Allgatherv(local_atoms.masses.data(), nb_local_, MPI_DOUBLE,
                    atoms.masses.data(), recvcount.data(), displ.data(),
                    MPI_DOUBLE, comm_);
+    MPI_Allgatherv(local_atoms.types.data(), nb_local_, MPI_INT,
+                   atoms.types.data(), recvcount.data(), displ.data(),
+                   MPI_INT, comm_);
     recvcount *= 3;
     displ *= 3;
     MPI_Allgatherv(local_atoms.positions.data(), 3 * nb_local_, MPI_DOUBLE,
@@ -145,6 +155,7 @@ void Domain::disable(Atoms &atoms) {
                    atoms.forces.data(), recvcount.data(), displ.data(),
                    MPI_DOUBLE, comm_);
 
+    ghost_transfers_.clear();
     is_enabled_ = false;
 }
 
@@ -156,12 +167,13 @@ Eigen::Index Domain::_exchange_atoms(Atoms &atoms, int dim) {
 
     // Pack send buffers. We need full particle information.
     auto send_left{MPI::Eigen::pack_buffer(
-        left_mask, atoms.masses, atoms.positions.row(0) + offset_left_(0, dim),
+        left_mask, atoms.masses, atoms.types,
+        atoms.positions.row(0) + offset_left_(0, dim),
         atoms.positions.row(1) + offset_left_(1, dim),
         atoms.positions.row(2) + offset_left_(2, dim), atoms.velocities.row(0),
         atoms.velocities.row(1), atoms.velocities.row(2))};
     auto send_right{MPI::Eigen::pack_buffer(
-        right_mask, atoms.masses,
+        right_mask, atoms.masses, atoms.types,
         atoms.positions.row(0) + offset_right_(0, dim),
         atoms.positions.row(1) + offset_right_(1, dim),
         atoms.positions.row(2) + offset_right_(2, dim), atoms.velocities.row(0),
@@ -175,6 +187,7 @@ Eigen::Index Domain::_exchange_atoms(Atoms &atoms, int dim) {
             if (i != nb_local_) {
                 // If it is not the last atom, we the last atom here
                 atoms.masses(i) = atoms.masses(nb_local_);
+                atoms.types(i) = atoms.types(nb_local_);
                 atoms.positions.col(i) = atoms.positions.col(nb_local_);
                 atoms.velocities.col(i) = atoms.velocities.col(nb_local_);
             }
@@ -191,12 +204,12 @@ Eigen::Index Domain::_exchange_atoms(Atoms &atoms, int dim) {
     atoms.resize(nb_local_ + recv_left.cols() + recv_right.cols());
 
     // Unpack buffers.
-    MPI::Eigen::unpack_buffer(recv_left, nb_local_, atoms.masses,
+    MPI::Eigen::unpack_buffer(recv_left, nb_local_, atoms.masses, atoms.types,
                               atoms.positions.row(0), atoms.positions.row(1),
                               atoms.positions.row(2), atoms.velocities.row(0),
                               atoms.velocities.row(1), atoms.velocities.row(2));
     MPI::Eigen::unpack_buffer(recv_right, nb_local_ + recv_left.cols(),
-                              atoms.masses, atoms.positions.row(0),
+                              atoms.masses, atoms.types, atoms.positions.row(0),
                               atoms.positions.row(1), atoms.positions.row(2),
                               atoms.velocities.row(0), atoms.velocities.row(1),
                               atoms.velocities.row(2));
@@ -215,6 +228,7 @@ void Domain::exchange_atoms(Atoms &atoms) {
 
     // Invalidate ghosts (we don't want to send those).
     atoms.resize(nb_local_);
+    ghost_transfers_.clear();
 
     // Loop as long as there is something left to be send. Multiple iterations
     // happen if atoms are farther than one subdomain away from where they
@@ -257,36 +271,78 @@ Domain::_update_ghosts(Atoms &atoms, double border_width, int dim,
     auto right_mask{right_positions.row(dim) >
                     right_domain_boundary - border_width};
 
+    // Convert masks to indices of the atoms that are sent. We keep these
+    // indices so the same atoms can be sent again by
+    // `update_ghost_positions`.
+    GhostTransfer transfer{dim, Eigen::ArrayXi(left_mask.count()),
+                           Eigen::ArrayXi(right_mask.count()),
+                           atoms.nb_atoms(), 0, 0};
+    for (Eigen::Index i{0}, n{0}; i < left_len; ++i)
+        if (left_mask(i))
+            transfer.send_left(n++) = left_start + i;
+    for (Eigen::Index i{0}, n{0}; i < right_len; ++i)
+        if (right_mask(i))
+            transfer.send_right(n++) = right_start + i;
+
+    // Send and receive ghost positions. Note that this resizes the Atoms
+    // object and invalidates left_mask and right_mask.
+    _communicate_ghosts(atoms, transfer, true);
+    ghost_transfers_.push_back(transfer);
+
+    return {transfer.nb_recv_left, transfer.nb_recv_right};
+}
+
+void Domain::_communicate_ghosts(Atoms &atoms, GhostTransfer &transfer,
+                                 bool with_types) {
+    auto dim{transfer.dim};
+
     // Pack send buffers. We only need positions.
-    auto send_left{MPI::Eigen::pack_buffer(
-        left_mask, left_positions.row(0) + offset_left_(0, dim),
-        left_positions.row(1) + offset_left_(1, dim),
-        left_positions.row(2) + offset_left_(2, dim))};
-    auto send_right{MPI::Eigen::pack_buffer(
-        right_mask, right_positions.row(0) + offset_right_(0, dim),
-        right_positions.row(1) + offset_right_(1, dim),
-        right_positions.row(2) + offset_right_(2, dim))};
+    Eigen::Array3Xd send_left{
+        atoms.positions(Eigen::all, transfer.send_left).colwise() +
+        offset_left_.col(dim).array()};
+    Eigen::Array3Xd send_right{
+        atoms.positions(Eigen::all, transfer.send_right).colwise() +
+        offset_right_.col(dim).array()};
 
     // Send and receive buffers.
     auto recv_right{
         MPI::Eigen::sendrecv(send_left, left_(dim), right_(dim), comm_)};
     auto recv_left{
         MPI::Eigen::sendrecv(send_right, right_(dim), left_(dim), comm_)};
+    transfer.nb_recv_left = recv_left.cols();
+    transfer.nb_recv_right = recv_right.cols();
 
-    // Resize Atoms object to store additional ghost atoms. Note that this
-    // invalidates left_mask and right_mask and we cannot use this after this
-    // step.
-    auto nb_last{atoms.nb_atoms()};
-    atoms.resize(nb_last + recv_left.cols() + recv_right.cols());
+    // Resize Atoms object to store additional ghost atoms. When refreshing
+    // ghost positions, the Atoms object already has the correct size.
+    auto nb_required{transfer.recv_start + recv_left.cols() +
+                     recv_right.cols()};
+    if (atoms.nb_atoms() < nb_required)
+        atoms.resize(nb_required);
 
     // Unpack receive buffers.
-    MPI::Eigen::unpack_buffer(recv_left, nb_last, atoms.positions.row(0),
-                              atoms.positions.row(1), atoms.positions.row(2));
-    MPI::Eigen::unpack_buffer(recv_right, nb_last + recv_left.cols(),
+    MPI::Eigen::unpack_buffer(recv_left, transfer.recv_start,
+                              atoms.positions.row(0), atoms.positions.row(1),
+                              atoms.positions.row(2));
+    MPI::Eigen::unpack_buffer(recv_right,
+                              transfer.recv_start + recv_left.cols(),
                               atoms.positions.row(0), atoms.positions.row(1),
                               atoms.positions.row(2));
 
-    return {recv_left.cols(), recv_right.cols()};
+    // The types of the ghosts only need to be sent when they are first
+    // received; they do not change when positions are refreshed.
+    if (with_types) {
+        using Types = Eigen::Array<int, 1, Eigen::Dynamic>;
+        Types send_types_left{atoms.types(transfer.send_left).transpose()};
+        Types send_types_right{atoms.types(transfer.send_right).transpose()};
+        auto recv_types_right{MPI::Eigen::sendrecv(send_types_left, left_(dim),
+                                                   right_(dim), comm_)};
+        auto recv_types_left{MPI::Eigen::sendrecv(
+            send_types_right, right_(dim), left_(dim), comm_)};
+        atoms.types.segment(transfer.recv_start, recv_left.cols()) =
+            recv_types_left.transpose();
+        atoms.types.segment(transfer.recv_start + recv_left.cols(),
+                            recv_right.cols()) = recv_types_right.transpose();
+    }
 }
 
 void Domain::update_ghosts(Atoms &atoms, double border_width) {
@@ -295,6 +351,7 @@ void Domain::update_ghosts(Atoms &atoms, double border_width) {
 
     // Remove all ghosts.
     atoms.resize(nb_local_);
+    ghost_transfers_.clear();
 
     // Loop over all Cartesian dimensions
     for (int dim{0}; dim < 3; ++dim) {
@@ -336,11 +393,60 @@ void Domain::update_ghosts(Atoms &atoms, double border_width) {
     }
 }
 
+void Domain::update_ghost_positions(Atoms &atoms) {
+    // This method only works if decomposition is enabled.
+    assert_enabled();
+
+    if (ghost_transfers_.empty())
+        throw std::runtime_error("Ghost atoms have been invalidated. Use "
+                                 "`update_ghosts` to communicate them.");
+
+    // Repeat all communication steps of the last call to `update_ghosts`.
+    for (auto &&transfer : ghost_transfers_) {
+        [[maybe_unused]] auto nb_recv{transfer.nb_recv_left +
+                                      transfer.nb_recv_right};
+        _communicate_ghosts(atoms, transfer, false);
+        assert(transfer.nb_recv_left + transfer.nb_recv_right == nb_recv);
+    }
+}
+
+bool Domain::update_if_needed(Atoms &atoms, NeighborList &neighbor_list,
+                              double border_width, double cutoff,
+                              double skin, bool sort, int nb_ghost_shells) {
+    // This method only works if decomposition is enabled.
+    assert_enabled();
+
+    // Move the ghost atoms along with the atoms they are images of. Ghost
+    // atoms cannot be reused if they have been invalidated.
+    bool ghosts_valid{!ghost_transfers_.empty()};
+    if (ghosts_valid)
+        update_ghost_positions(atoms);
+
+    // Check whether the local neighbor list is stale.
+    int local_update{!ghosts_valid ||
+                     neighbor_list.needs_update(atoms, cutoff, skin)};
+
+    // Exchanging atoms and ghosts are collective operations, hence all
+    // processes need to rebuild if any one of them needs to.
+    if (MPI::allreduce(local_update, MPI_LOR, comm_)) {
+        exchange_atoms(atoms);
+        // Only local atoms are present at this point; ghosts are appended
+        // in sorted order by `update_ghosts`.
+        if (sort)
+            sort_atoms(atoms, cutoff);
+        update_ghosts(atoms, border_width);
+        neighbor_list.update(atoms, cutoff, skin, nb_local_, nb_ghost_shells);
+        return true;
+    }
+    return false;
+}
+
 void Domain::scale(Atoms &atoms, Eigen::Array3d domain_length) {
     Eigen::Array3d scale_factor{domain_length / domain_length_};
 
     // Invalidate ghosts.
     atoms.resize(nb_local_);
+    ghost_transfers_.clear();
 
     // Rescale atomic positions.
     for (auto &&position : atoms.positions.colwise()) {
@@ -29,6 +29,7 @@
 
 #include "atoms.h"
 #include "mpi_support.h"
+#include "neighbors.h"
 
 class Domain {
 public:
@@ -39,7 +40,8 @@ public:
 
     /*
      * Enable domain decomposition: After a call to this method, every process
-     * remains only with the atoms in its local domain.
+     * remains only with the atoms in its local domain. Throws if the atoms do
+     * not have one type per atom.
      */
     void enable(Atoms &atoms);
 
@@ -59,7 +61,34 @@ public:
      * Communicate atoms into the ghost buffers of neighboring cells.
      */
     void update_ghosts(Atoms &atoms, double border_width);
-    
+
+    /*
+     * Refresh the positions of the ghost atoms without changing which atoms
+     * are ghosts. This repeats the communication pattern of the last call to
+     * `update_ghosts` and hence requires that no atoms have been exchanged
+     * since then.
+     */
+    void update_ghost_positions(Atoms &atoms);
+
+    /*
+     * Rebuild the neighbor list (with a skin distance) only if some atom on
+     * any process has moved by more than half the skin. If a rebuild is
+     * necessary, atoms are exchanged, ghost atoms are communicated and the
+     * neighbor list is updated; otherwise only the ghost positions are
+     * refreshed. The decision is agreed across all processes. Note that the
+     * ghost atoms need to cover the skin distance, e.g. for EAM potentials
+     * `border_width` should be twice `cutoff + skin`. The neighbor list only
+     * contains the rows of the local atoms and of the ghosts within
+     * `nb_ghost_shells` neighbor shells of them (see `NeighborList::update`).
+     * The default of one shell is what EAM potentials need; pair potentials
+     * can pass zero. Returns
+     * true if the neighbor list was rebuilt. If `sort` is true, the local
+     * atoms are sorted along a space-filling curve (see `sort_atoms`) on every
+     * rebuild. This changes the order of the atoms on each process.
+     */
+    bool update_if_needed(Atoms &atoms, NeighborList &neighbor_list, double border_width, double cutoff,
+                          double skin, bool sort = false, int nb_ghost_shells = 1);
+
     /*
      * Set new domain length and (affinely) rescale atom positions.
      */
@@ -161,6 +190,25 @@ protected:
                    Eigen::Index left_start, Eigen::Index left_len,
                    Eigen::Index right_start, Eigen::Index right_len);
 
+    /*
+     * Record of a single ghost communication step in Cartesian direction
+     * *dim*: The indices of the atoms that were sent to the left and right and
+     * where the received ghosts were stored.
+     */
+    struct GhostTransfer {
+        int dim;
+        Eigen::ArrayXi send_left, send_right;
+        Eigen::Index recv_start, nb_recv_left, nb_recv_right;
+    };
+
+    /*
+     * Send the positions (and the types if `with_types` is true) of the atoms
+     * listed in `transfer` and store the received ghosts starting at
+     * `transfer.recv_start`. This grows the atoms object if necessary and
+     * fills in the receive counts.
+     */
+    void _communicate_ghosts(Atoms &atoms, GhostTransfer &transfer, bool with_types);
+
     // MPI communicator
     MPI_Comm comm_;
 
@@ -190,6 +238,10 @@ protected:
 
     // Offsets for periodic boundary conditions
     Eigen::Matrix3d offset_left_, offset_right_;
+
+    // Communication pattern of the last call to `update_ghosts`; empty if
+    // the ghost atoms have been invalidated since
+    std::vector<GhostTransfer> ghost_transfers_;
 };
 
 
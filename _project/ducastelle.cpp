@@ -22,9 +22,111 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
+#include "cluster_pair_list.h"
+#include "compressed_neighbor_list.h"
 #include "ducastelle.h"
+#include "openmp_support.h"
+#include "virial.h"
+
+DucastelleParameters::DucastelleParameters(
+    const std::vector<std::string> &elements)
+    : elements_{elements},
+      pairs_(elements.size() * elements.size(),
+             {NAN, NAN, NAN, NAN, NAN}) {}
+
+int DucastelleParameters::_index(const std::string &element) const {
+    auto it{std::find(elements_.begin(), elements_.end(), element)};
+    if (it == elements_.end()) {
+        throw std::runtime_error("Element " + element +
+                                 " is not described by the Ducastelle "
+                                 "parameters.");
+    }
+    return static_cast<int>(it - elements_.begin());
+}
+
+void DucastelleParameters::set(const std::string &a, const std::string &b,
+                               double A, double xi, double p, double q,
+                               double re) {
+    const int nb_elements{static_cast<int>(elements_.size())};
+    const int index_a{_index(a)}, index_b{_index(b)};
+    pairs_[index_a * nb_elements + index_b] = {A, xi * xi, p, q, re};
+    pairs_[index_b * nb_elements + index_a] = {A, xi * xi, p, q, re};
+}
+
+bool DucastelleParameters::is_complete() const {
+    return std::none_of(pairs_.begin(), pairs_.end(),
+                        [](const Pair &pair) { return std::isnan(pair.A); });
+}
+
+Eigen::ArrayXi
+DucastelleParameters::element_indices(const Names_t &names) const {
+    Eigen::ArrayXi indices(names.size());
+    for (size_t i{0}; i < names.size(); ++i)
+        indices(i) = _index(names[i]);
+    return indices;
+}
+
+/*
+ * Group the rows of a neighbor list into blocks of `block_size` consecutive
+ * atoms and color the blocks greedily, such that blocks of the same color
+ * never write to the same atom. Row i writes to atom i and to all its
+ * neighbors j (only j > i for a full list). Returns the blocks of each color.
+ * Blocks that cannot be given one of the 64 colors are returned as a last
+ * group that must be processed serially. Blocks are compact, and coloring
+ * needs few colors, if atoms are sorted spatially (see `sort_atoms`).
+ */
+template <typename NeighborListType>
+static std::vector<std::vector<int>>
+color_row_blocks(const NeighborListType &neighbor_list, int nb_atoms,
+                 int block_size, std::vector<int> &serial_blocks) {
+    const int nb_blocks{(nb_atoms + block_size - 1) / block_size};
+
+    // Colors of the blocks that write to each atom
+    std::vector<uint64_t> atom_colors(nb_atoms, 0);
+    std::vector<std::vector<int>> colors;
+    for (int block{0}; block < nb_blocks; ++block) {
+        const int begin{block * block_size};
+        const int end{std::min(begin + block_size, nb_atoms)};
+
+        // Colors of blocks that write to any atom this block writes to
+        uint64_t forbidden{0};
+        for (int i{begin}; i < end; ++i) {
+            forbidden |= atom_colors[i];
+            for (int j : neighbor_list.neighbors(i))
+                if (neighbor_list.is_pair_entry(i, j))
+                    forbidden |= atom_colors[j];
+        }
+        if (forbidden == ~uint64_t{0}) {
+            serial_blocks.push_back(block);
+            continue;
+        }
+
+        // Lowest free color
+        int color{0};
+        while (forbidden >> color & 1)
+            ++color;
+        if (color == static_cast<int>(colors.size()))
+            colors.emplace_back();
+        colors[color].push_back(block);
+
+        const uint64_t bit{uint64_t{1} << color};
+        for (int i{begin}; i < end; ++i) {
+            atom_colors[i] |= bit;
+            for (int j : neighbor_list.neighbors(i))
+                if (neighbor_list.is_pair_entry(i, j))
+                    atom_colors[j] |= bit;
+        }
+    }
+    return colors;
+}
 
 /*
  * This is the embedded atom method potential described in
@@ -33,88 +135,692 @@
  * 6265 (1981) Cleri, Rosato, "Tight-binding potentials for transition metals
  * and alloys", Phys. Rev. B 48, 22 (1993) The default values for the parameters
  * are the Au parameters from Cleri & Rosato's paper.
+ * This implementation works with any neighbor list that provides `is_half`
+ * and `neighbors(i)`. The geometry of the n-th neighbor j of atom i is
+ * obtained from `pair_geometry(i, n, j, distance_vector, distance)`, which
+ * returns false if the pair is outside of the cutoff. The parameters of the
+ * pair are obtained from `pair_parameters(i, j)`. The virial is computed if
+ * `virial` is not null.
+ */
+template <typename NeighborListType, typename PairGeometry,
+          typename PairParameters>
+static double ducastelle_rows(Atoms &atoms,
+                              const NeighborListType &neighbor_list,
+                              PairGeometry &&pair_geometry,
+                              PairParameters &&pair_parameters,
+                              ThreadSchedule schedule, Virial *virial) {
+    using AtomVirials = Virial::PerAtom;
+
+    // Rows per block for the colored schedule
+    constexpr int block_size{64};
+
+    const int nb_atoms{static_cast<int>(atoms.nb_atoms())};
+    const int nb_threads{max_threads()};
+
+    // Reset forces; per-atom energies are overwritten at the end. Use the
+    // `Ducastelle` class to combine this potential with others.
+    atoms.forces.setZero();
+
+    if (schedule == ThreadSchedule::gather && neighbor_list.is_half())
+        throw std::runtime_error(
+            "The gather schedule requires a full neighbor list.");
+    if (nb_threads == 1) {
+        schedule = ThreadSchedule::serial;
+    } else if (schedule == ThreadSchedule::automatic) {
+        // Buffers need memory and a reduction that grow with the number of
+        // threads. Beyond that, full lists are gathered, which needs neither
+        // buffers nor synchronization between colors.
+        if (nb_threads <= 8)
+            schedule = ThreadSchedule::buffers;
+        else
+            schedule = neighbor_list.is_half() ? ThreadSchedule::coloring
+                                               : ThreadSchedule::gather;
+    }
+
+    // When gathering, every row visits all entries of the full list and
+    // writes only to its own atom. Each pair is hence computed twice.
+    const bool gather{schedule == ThreadSchedule::gather};
+
+    // The first pass accumulates densities and repulsive energies. Both
+    // exponentials of a pair are evaluated only here; the derivatives that
+    // the second pass needs are stored in the order in which pairs within
+    // the cutoff are visited. Each thread stores the pairs of the rows it
+    // visits in its own buffer; row i starts at `row_start(i)` in the buffer
+    // of thread `row_thread(i)`. The thread index is that within the parallel
+    // regions below; rows visited outside of them use buffer 0.
+    std::vector<std::vector<std::array<double, 2>>> d_pair_energies(
+        nb_threads);
+    Eigen::ArrayXi row_thread(nb_atoms), row_start(nb_atoms);
+
+    auto density_row = [&](int i, int thread, Eigen::ArrayXd &density,
+                           Eigen::ArrayXd &energies) {
+        auto &d_pair_energies_i{d_pair_energies[thread]};
+        row_thread(i) = thread;
+        row_start(i) = static_cast<int>(d_pair_energies_i.size());
+
+        Eigen::Array3d distance_vector;
+        double distance, density_i{0}, energy_i{0};
+        int n{-1};  // position of j within the row of i
+        for (int j : neighbor_list.neighbors(i)) {
+            ++n;
+            if (!gather && !neighbor_list.is_pair_entry(i, j))
+                continue;
+            if (pair_geometry(i, n, j, distance_vector, distance)) {
+                const auto &pair{pair_parameters(i, j)};
+                double density_contribution{pair.density(distance)};
+                density_i += density_contribution;
+
+                // repulsive energy, split evenly between both atoms
+                double repulsive_energy{pair.repulsive_energy(distance)};
+                energy_i += repulsive_energy;
+
+                if (!gather) {
+                    density(j) += density_contribution;
+                    energies(j) += repulsive_energy;
+                }
+
+                // derivatives of repulsive energy and density with respect
+                // to distance
+                d_pair_energies_i.push_back(
+                    {2 * pair.d_repulsive_energy(repulsive_energy),
+                     pair.d_density(density_contribution)});
+            }
+        }
+        density(i) += density_i;
+        energies(i) += energy_i;
+    };
+
+    // The virial of the pairs that each row visits is stored per row and
+    // summed in the order of the rows, such that the total does not depend
+    // on the schedule. Each pair is visited twice when gathering. Per-atom
+    // virials are scattered like the forces.
+    const double row_weight{gather ? 0.5 : 1.0};
+    AtomVirials row_virials;
+    if (virial)
+        row_virials.setZero(9, nb_atoms);
+
+    // The second pass computes the forces from the stored derivatives and
+    // the derivative of the embedding energy
+    Eigen::ArrayXd d_embedding;
+    auto force_row = [&](int i, Forces_t &forces, AtomVirials *atom_virials) {
+        const auto *d_pair_energy{
+            &d_pair_energies[row_thread(i)][row_start(i)]};
+        const double d_embedding_i{d_embedding(i)};
+
+        // forces and virial of atom i are accumulated locally
+        Eigen::Array3d distance_vector, force_i{Eigen::Array3d::Zero()};
+        Eigen::Matrix3d virial_i{Eigen::Matrix3d::Zero()};
+        double distance;
+        int n{-1};  // position of j within the row of i
+        for (int j : neighbor_list.neighbors(i)) {
+            ++n;
+            if (!gather && !neighbor_list.is_pair_entry(i, j))
+                continue;
+            if (pair_geometry(i, n, j, distance_vector, distance)) {
+                auto [d_repulsive_energy, d_density]{*d_pair_energy++};
+                Eigen::Array3d pair_force{
+                    (d_repulsive_energy +
+                     d_density * (d_embedding_i + d_embedding(j))) /
+                    distance * distance_vector};
+
+                // sum per-atom forces
+                force_i -= pair_force;
+                if (!gather)
+                    forces.col(j) += pair_force;
+
+                if (virial) {
+                    const Eigen::Matrix3d pair_virial{
+                        Virial::pair(distance_vector, pair_force)};
+                    virial_i += virial->weight(i, j) * pair_virial;
+                    if (atom_virials) {
+                        Virial::add_atom(*atom_virials, i, 0.5 * pair_virial);
+                        if (!gather)
+                            Virial::add_atom(*atom_virials, j,
+                                             0.5 * pair_virial);
+                    }
+                }
+            }
+        }
+        forces.col(i) += force_i;
+        if (virial)
+            row_virials.col(i) =
+                row_weight *
+                Eigen::Map<Eigen::Array<double, 9, 1>>(virial_i.data());
+    };
+
+    AtomVirials *atom_virials{nullptr};
+    if (virial) {
+        virial->reset(nb_atoms);
+        if (virial->compute_per_atom)
+            atom_virials = &virial->per_atom;
+    }
+
+    Eigen::ArrayXd density{Eigen::ArrayXd::Zero(nb_atoms)};
+    Eigen::ArrayXd energies{Eigen::ArrayXd::Zero(nb_atoms)};
+    auto compute_d_embedding = [&]() {
+        // embedding energy and its derivative
+        energies += ducastelle_embedding(density, d_embedding);
+    };
+
+    if (schedule == ThreadSchedule::serial) {
+        for (int i{0}; i < nb_atoms; ++i)
+            density_row(i, 0, density, energies);
+        compute_d_embedding();
+        for (int i{0}; i < nb_atoms; ++i)
+            force_row(i, atoms.forces, atom_virials);
+    } else if (schedule == ThreadSchedule::gather) {
+        // Rows write to disjoint atoms and need no reduction
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nb_atoms; ++i)
+            density_row(i, thread_num(), density, energies);
+        compute_d_embedding();
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nb_atoms; ++i)
+            force_row(i, atoms.forces, atom_virials);
+    } else if (schedule == ThreadSchedule::buffers) {
+        // Each thread scatters into its own arrays, which are summed in the
+        // order of the threads. The static schedule assigns the same rows to
+        // the same thread in both passes and on every call. The team may be
+        // smaller than `nb_threads` (dynamic adjustment or nested regions);
+        // only the buffers of threads that actually ran are summed.
+        std::vector<Eigen::ArrayXd> thread_density(nb_threads),
+            thread_energies(nb_threads);
+        std::vector<Forces_t> thread_forces(nb_threads);
+        std::vector<AtomVirials> thread_atom_virials(nb_threads);
+        int nb_team_threads{1};
+#pragma omp parallel
+        {
+            const int thread{thread_num()};
+#pragma omp single nowait
+            nb_team_threads = num_threads();
+            thread_density[thread] = Eigen::ArrayXd::Zero(nb_atoms);
+            thread_energies[thread] = Eigen::ArrayXd::Zero(nb_atoms);
+#pragma omp for schedule(static)
+            for (int i = 0; i < nb_atoms; ++i)
+                density_row(i, thread, thread_density[thread],
+                            thread_energies[thread]);
+        }
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nb_atoms; ++i) {
+            for (int thread{0}; thread < nb_team_threads; ++thread) {
+                density(i) += thread_density[thread](i);
+                energies(i) += thread_energies[thread](i);
+            }
+        }
+
+        compute_d_embedding();
+#pragma omp parallel
+        {
+            const int thread{thread_num()};
+#pragma omp single nowait
+            nb_team_threads = num_threads();
+            thread_forces[thread] = Forces_t::Zero(3, nb_atoms);
+            if (atom_virials)
+                thread_atom_virials[thread].setZero(9, nb_atoms);
+#pragma omp for schedule(static)
+            for (int i = 0; i < nb_atoms; ++i)
+                force_row(i, thread_forces[thread],
+                          atom_virials ? &thread_atom_virials[thread]
+                                       : nullptr);
+        }
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nb_atoms; ++i) {
+            for (int thread{0}; thread < nb_team_threads; ++thread) {
+                atoms.forces.col(i) += thread_forces[thread].col(i);
+                if (atom_virials)
+                    atom_virials->col(i) += thread_atom_virials[thread].col(i);
+            }
+        }
+    } else {
+        // Blocks of one color write to disjoint atoms and are processed in
+        // parallel without any reduction. Every atom receives its
+        // contributions in the same order irrespective of the number of
+        // threads.
+        std::vector<int> serial_blocks;
+        auto colors{color_row_blocks(neighbor_list, nb_atoms, block_size,
+                                     serial_blocks)};
+        auto for_each_row = [&](auto &&row) {
+            for (auto &blocks : colors) {
+                const int nb_blocks{static_cast<int>(blocks.size())};
+#pragma omp parallel for schedule(dynamic)
+                for (int b = 0; b < nb_blocks; ++b) {
+                    const int begin{blocks[b] * block_size};
+                    const int end{std::min(begin + block_size, nb_atoms)};
+                    for (int i{begin}; i < end; ++i)
+                        row(i, thread_num());
+                }
+            }
+            for (int block : serial_blocks) {
+                const int begin{block * block_size};
+                const int end{std::min(begin + block_size, nb_atoms)};
+                for (int i{begin}; i < end; ++i)
+                    row(i, 0);
+            }
+        };
+        for_each_row([&](int i, int thread) {
+            density_row(i, thread, density, energies);
+        });
+        compute_d_embedding();
+        for_each_row([&](int i, int) {
+            force_row(i, atoms.forces, atom_virials);
+        });
+    }
+
+    if (virial) {
+        Eigen::Array<double, 9, 1> total{row_virials.rowwise().sum()};
+        virial->total = Eigen::Map<Eigen::Matrix3d>(total.data());
+    }
+
+    // Store per-atom energies and return total potential energy
+    atoms.energies = energies;
+    return energies.sum();
+}
+
+/*
+ * Compute the geometry of a pair from the positions, using the minimum image
+ * convention of the neighbor list
+ */
+template <typename NeighborListType, typename PairParameters>
+static double ducastelle_minimum_image(Atoms &atoms,
+                                       const NeighborListType &neighbor_list,
+                                       double cutoff,
+                                       PairParameters &&pair_parameters,
+                                       ThreadSchedule schedule,
+                                       Virial *virial = nullptr) {
+    const double cutoff_sq{cutoff * cutoff};
+    auto &&positions{atoms.positions};
+    return ducastelle_rows(
+        atoms, neighbor_list,
+        [&](int i, int, int j, Eigen::Array3d &distance_vector,
+            double &distance) {
+            distance_vector =
+                neighbor_list.minimum_image(positions.col(i) - positions.col(j));
+            const double distance_sq{distance_vector.square().sum()};
+            if (distance_sq >= cutoff_sq)
+                return false;
+            distance = std::sqrt(distance_sq);
+            return true;
+        },
+        pair_parameters, schedule, virial);
+}
+
+/*
+ * Use the pair geometry stored in the neighbor list if it is up to date
  */
+template <typename PairParameters>
+static double ducastelle_neighbor_list(Atoms &atoms,
+                                       const NeighborList &neighbor_list,
+                                       double cutoff,
+                                       PairParameters &&pair_parameters,
+                                       ThreadSchedule schedule,
+                                       Virial *virial) {
+    if (!neighbor_list.has_pair_geometry(atoms.positions))
+        return ducastelle_minimum_image(atoms, neighbor_list, cutoff,
+                                        pair_parameters, schedule, virial);
+
+    // Read distance vectors and distances from the list
+    return ducastelle_rows(
+        atoms, neighbor_list,
+        [&](int i, int n, int, Eigen::Array3d &distance_vector,
+            double &distance) {
+            distance = neighbor_list.pair_distances(i)(n);
+            if (distance >= cutoff)
+                return false;
+            distance_vector = neighbor_list.pair_distance_vectors(i).col(n);
+            return true;
+        },
+        pair_parameters, schedule, virial);
+}
+
+/*
+ * Return a lookup of the parameters of a pair of atoms that gives the same
+ * parameters for all pairs
+ */
+static auto constant_pair_parameters(double A, double xi, double p, double q,
+                                     double re) {
+    return [parameters = DucastelleParameters::Pair{A, xi * xi, p, q, re}](
+               int, int) -> const DucastelleParameters::Pair & {
+        return parameters;
+    };
+}
+
 double ducastelle(Atoms &atoms, const NeighborList &neighbor_list,
+                  double cutoff, double A, double xi, double p, double q,
+                  double re, ThreadSchedule schedule) {
+    return ducastelle_neighbor_list(atoms, neighbor_list, cutoff,
+                                    constant_pair_parameters(A, xi, p, q, re),
+                                    schedule, nullptr);
+}
+
+double ducastelle(Atoms &atoms, const NeighborList &neighbor_list,
+                  Virial &virial, double cutoff, double A, double xi, double p,
+                  double q, double re, ThreadSchedule schedule) {
+    return ducastelle_neighbor_list(atoms, neighbor_list, cutoff,
+                                    constant_pair_parameters(A, xi, p, q, re),
+                                    schedule, &virial);
+}
+
+static double ducastelle_alloy(Atoms &atoms, const NeighborList &neighbor_list,
+                               const DucastelleParameters &parameters,
+                               double cutoff, ThreadSchedule schedule,
+                               Virial *virial) {
+    if (!parameters.is_complete())
+        throw std::runtime_error("Not all pairs of elements have Ducastelle "
+                                 "parameters.");
+
+    // The types of the atoms are indices into `parameters.elements()`; the
+    // pair loops use them to find the parameters of a pair in a flat table.
+    const Eigen::ArrayXi &element{atoms.types};
+    const int nb_elements{static_cast<int>(parameters.elements().size())};
+    if (element.size() != static_cast<Eigen::Index>(atoms.nb_atoms()))
+        throw std::runtime_error("The number of atom types does not match the "
+                                 "number of atoms.");
+    if (element.size() > 0 &&
+        (element.minCoeff() < 0 || element.maxCoeff() >= nb_elements))
+        throw std::runtime_error("Atom type is not described by the "
+                                 "Ducastelle parameters.");
+    return ducastelle_neighbor_list(
+        atoms, neighbor_list, cutoff,
+        [&](int i, int j) -> const DucastelleParameters::Pair & {
+            return parameters(element(i), element(j));
+        },
+        schedule, virial);
+}
+
+double ducastelle(Atoms &atoms, const NeighborList &neighbor_list,
+                  const DucastelleParameters &parameters, double cutoff,
+                  ThreadSchedule schedule) {
+    return ducastelle_alloy(atoms, neighbor_list, parameters, cutoff, schedule,
+                            nullptr);
+}
+
+double ducastelle(Atoms &atoms, const NeighborList &neighbor_list,
+                  const DucastelleParameters &parameters, Virial &virial,
+                  double cutoff, ThreadSchedule schedule) {
+    return ducastelle_alloy(atoms, neighbor_list, parameters, cutoff, schedule,
+                            &virial);
+}
+
+double ducastelle(Atoms &atoms, const CompressedNeighborList &neighbor_list,
+                  double cutoff, double A, double xi, double p, double q,
+                  double re, ThreadSchedule schedule) {
+    return ducastelle_minimum_image(atoms, neighbor_list, cutoff,
+                                    constant_pair_parameters(A, xi, p, q, re),
+                                    schedule);
+}
+
+double ducastelle(Atoms &atoms, const NeighborListView &neighbor_list,
+                  double cutoff, double A, double xi, double p, double q,
+                  double re, ThreadSchedule schedule) {
+    return ducastelle_minimum_image(atoms, neighbor_list, cutoff,
+                                    constant_pair_parameters(A, xi, p, q, re),
+                                    schedule);
+}
+
+/*
+ * Vectorized kernel; distances, exponentials and pair forces are computed in
+ * the floating point type `Real`, while densities, energies and forces are
+ * accumulated in double precision.
+ */
+template <typename Real>
+static double ducastelle_blocks(Atoms &atoms, const NeighborList &neighbor_list,
+                                double cutoff, double A, double xi, double p,
+                                double q, double re) {
+    // Number of pairs that are processed at once. The arrays of a block fit
+    // into the L1 cache.
+    constexpr int block_size{256};
+    using BlockArray = Eigen::Array<Real, block_size, 1>;
+
+    auto cutoff_sq{cutoff * cutoff};
+
+    // Parameters in the precision of the pair arithmetic
+    const Real A_r{static_cast<Real>(A)}, xi_sq_r{static_cast<Real>(xi * xi)},
+        p_r{static_cast<Real>(p)}, q_r{static_cast<Real>(q)},
+        re_r{static_cast<Real>(re)};
+    auto &&positions{atoms.positions};
+    auto &&[seed, neighbors]{neighbor_list.neighbors()};
+
+    // Atom indices and distance vectors of the pairs of the current block
+    Eigen::Array<int, block_size, 1> pair_i, pair_j;
+    BlockArray dx, dy, dz;
+
+    // Call `process(offset, nb_pairs)` for every block of pairs within the
+    // cutoff; `offset` is the number of pairs in all previous blocks. Only
+    // pairs within the cutoff are stored, hence the vectorized arithmetic
+    // needs no mask. All blocks but the last one are full. The unused
+    // entries of the last block are set to a finite distance and ignored.
+    // Distance vectors are computed from the positions in double precision
+    // and only then rounded to `Real`. Their precision is hence relative to
+    // the distance and does not degrade with the distance of the atoms from
+    // the origin.
+    auto for_each_block = [&](auto &&process) {
+        int offset{0}, nb_pairs{0};
+        for (int i{0}; i < atoms.nb_atoms(); ++i) {
+            Eigen::Array3d position_i{positions.col(i)};
+            for (int n{seed(i)}; n < seed(i + 1); ++n) {
+                const int j{neighbors(n)};
+                if (!neighbor_list.is_pair_entry(i, j))
+                    continue;
+                Eigen::Array3d distance_vector{neighbor_list.minimum_image(
+                    position_i - positions.col(j))};
+                if (distance_vector.square().sum() >= cutoff_sq)
+                    continue;
+                pair_i(nb_pairs) = i;
+                pair_j(nb_pairs) = j;
+                dx(nb_pairs) = static_cast<Real>(distance_vector(0));
+                dy(nb_pairs) = static_cast<Real>(distance_vector(1));
+                dz(nb_pairs) = static_cast<Real>(distance_vector(2));
+                if (++nb_pairs == block_size) {
+                    process(offset, nb_pairs);
+                    offset += nb_pairs;
+                    nb_pairs = 0;
+                }
+            }
+        }
+        if (nb_pairs > 0) {
+            dx.tail(block_size - nb_pairs).setConstant(Real(cutoff));
+            dy.tail(block_size - nb_pairs).setZero();
+            dz.tail(block_size - nb_pairs).setZero();
+            process(offset, nb_pairs);
+        }
+    };
+
+    // Derivatives of the repulsive energy and of the density with respect
+    // to distance, divided by distance, for all pairs in the order in which
+    // they are visited. The last block is read in full, hence the padding.
+    std::vector<Real> d_repulsive_energies(neighbor_list.nb_neighbors() +
+                                           block_size);
+    std::vector<Real> d_densities(neighbor_list.nb_neighbors() + block_size);
+
+    // First pass: densities and repulsive energies
+    Eigen::ArrayXd density{Eigen::ArrayXd::Zero(atoms.nb_atoms())};
+    Eigen::ArrayXd energies{Eigen::ArrayXd::Zero(atoms.nb_atoms())};
+    for_each_block([&](int offset, int nb_pairs) {
+        BlockArray distance{(dx.square() + dy.square() + dz.square()).sqrt()};
+        BlockArray x{distance / re_r - Real(1)};
+        BlockArray density_contribution{xi_sq_r * (-2 * q_r * x).exp()};
+        BlockArray repulsive_energy{A_r * (-p_r * x).exp()};
+        for (int k{0}; k < nb_pairs; ++k) {
+            density(pair_i(k)) += density_contribution(k);
+            density(pair_j(k)) += density_contribution(k);
+            energies(pair_i(k)) += repulsive_energy(k);
+            energies(pair_j(k)) += repulsive_energy(k);
+        }
+
+        BlockArray d_repulsive_energy{-2 * p_r / re_r * repulsive_energy /
+                                      distance};
+        BlockArray d_density{-2 * q_r / re_r * density_contribution /
+                             distance};
+        std::copy_n(d_repulsive_energy.data(), nb_pairs,
+                    &d_repulsive_energies[offset]);
+        std::copy_n(d_density.data(), nb_pairs, &d_densities[offset]);
+    });
+
+    // embedding energy and its derivative
+    Eigen::ArrayXd d_embedding;
+    energies += ducastelle_embedding(density, d_embedding);
+
+    // Second pass: forces
+    atoms.forces.setZero();
+    BlockArray d_embedding_ij{BlockArray::Zero()};
+    for_each_block([&](int offset, int nb_pairs) {
+        for (int k{0}; k < nb_pairs; ++k) {
+            d_embedding_ij(k) = static_cast<Real>(d_embedding(pair_i(k)) +
+                                                  d_embedding(pair_j(k)));
+        }
+        BlockArray pair_force{
+            Eigen::Map<const BlockArray>(&d_repulsive_energies[offset]) +
+            Eigen::Map<const BlockArray>(&d_densities[offset]) *
+                d_embedding_ij};
+        BlockArray force_x{pair_force * dx}, force_y{pair_force * dy},
+            force_z{pair_force * dz};
+        for (int k{0}; k < nb_pairs; ++k) {
+            const int i{pair_i(k)}, j{pair_j(k)};
+            atoms.forces(0, i) -= force_x(k);
+            atoms.forces(1, i) -= force_y(k);
+            atoms.forces(2, i) -= force_z(k);
+            atoms.forces(0, j) += force_x(k);
+            atoms.forces(1, j) += force_y(k);
+            atoms.forces(2, j) += force_z(k);
+        }
+    });
+
+    // Store per-atom energies and return total potential energy
+    atoms.energies = energies;
+    return energies.sum();
+}
+
+double ducastelle_vectorized(Atoms &atoms, const NeighborList &neighbor_list,
+                             double cutoff, double A, double xi, double p,
+                             double q, double re) {
+    return ducastelle_blocks<double>(atoms, neighbor_list, cutoff, A, xi, p, q,
+                                     re);
+}
+
+double ducastelle_mixed_precision(Atoms &atoms,
+                                  const NeighborList &neighbor_list,
+                                  double cutoff, double A, double xi, double p,
+                                  double q, double re) {
+    return ducastelle_blocks<float>(atoms, neighbor_list, cutoff, A, xi, p, q,
+                                    re);
+}
+
+template <int N>
+double ducastelle(Atoms &atoms, const ClusterPairList<N> &cluster_pair_list,
                   double cutoff, double A, double xi, double p, double q,
                   double re) {
+    using Block = Eigen::Array<double, N, N>;
+    using Column = Eigen::Array<double, N, 1>;
+    using ClusterArray = Eigen::Array<double, N, Eigen::Dynamic>;
+
     auto cutoff_sq{cutoff * cutoff};
     double xi_sq{xi * xi};
+    const int nb_clusters{cluster_pair_list.nb_clusters()};
 
-    // Reset energies and forces. This needs to be turned off if multiple
-    // potentials are present.
-    atoms.forces.setZero();
+    // Within the self pair (I, I) only the pairs i < j are counted.
+    Eigen::Array<bool, N, N> upper_triangle;
+    for (int k{0}; k < N; ++k)
+        for (int l{0}; l < N; ++l)
+            upper_triangle(k, l) = k < l;
 
-    // compute embedding energies
-    Eigen::ArrayXd embedding(
-        atoms.nb_atoms()); // contains first density, later energy
-    embedding.setZero();
-    for (auto [i, j] : neighbor_list) {
-        if (i < j) {
-            Eigen::Vector3d distance_vector{atoms.positions.col(i) -
-                                            atoms.positions.col(j)};
-            auto distance_sq = distance_vector.squaredNorm();
-            if (distance_sq < cutoff_sq) {
-                double density_contribution{
-                    xi_sq *
-                    std::exp(-2 * q * (std::sqrt(distance_sq) / re - 1.0))};
-                embedding(i) += density_contribution;
-                embedding(j) += density_contribution;
-            }
+    // Coordinates in cluster order; column 3 * I + dim of `positions` holds
+    // component dim of all atoms in cluster I.
+    auto positions{cluster_pair_list.gather(atoms.positions)};
+
+    // Squared distances and mask of pairs within the cutoff for a block of
+    // NxN atoms
+    auto distances = [&](int I, int J, Block(&distance_vector)[3],
+                         Block &distance_sq, Eigen::Array<bool, N, N> &mask) {
+        for (int dim{0}; dim < 3; ++dim) {
+            distance_vector[dim] =
+                positions.col(3 * I + dim).replicate(1, N) -
+                positions.col(3 * J + dim).transpose().replicate(N, 1);
         }
+        distance_sq = distance_vector[0].square() +
+                      distance_vector[1].square() +
+                      distance_vector[2].square();
+        mask = distance_sq < cutoff_sq;
+        if (I == J)
+            mask = mask && upper_triangle;
+    };
+
+    // compute densities in cluster order
+    ClusterArray density{ClusterArray::Zero(N, nb_clusters)};
+    Block distance_vector[3], distance_sq;
+    Eigen::Array<bool, N, N> mask;
+    for (auto [I, J] : cluster_pair_list) {
+        distances(I, J, distance_vector, distance_sq, mask);
+        Block density_contribution{mask.select(
+            xi_sq * (-2 * q * (distance_sq.sqrt() / re - 1.0)).exp(), 0)};
+        density.col(I) += density_contribution.rowwise().sum();
+        density.col(J) += density_contribution.colwise().sum().transpose();
     }
 
-    // compute embedding contribution to the potential energy
-    embedding = -embedding.sqrt();
-
-    // per-atom energies
-    Eigen::ArrayXd energies{embedding};
-
-    // compute forces
-    for (auto [i, j] : neighbor_list) {
-        if (i < j) {
-            double d_embedding_density_i{0};
-            // this is the derivative of sqrt(embedding)
-            if (embedding(i) != 0)
-                d_embedding_density_i = 1 / (2 * embedding(i));
-
-            Eigen::Vector3d distance_vector{atoms.positions.col(i) -
-                                            atoms.positions.col(j)};
-            auto distance_sq = distance_vector.squaredNorm();
-            if (distance_sq < cutoff_sq) {
-                double distance{std::sqrt(distance_sq)};
-                double d_embedding_density_j{0};
-                // this is the derivative of sqrt(embedding)
-                if (embedding(j) != 0)
-                    d_embedding_density_j = 1 / (2 * embedding(j));
-
-                // repulsive energy and derivative of it with respect to
-                // distance
-                double repulsive_energy{2 * A *
-                                        std::exp(-p * (distance / re - 1.0))};
-                double d_repulsive_energy{-repulsive_energy * p / re};
-
-                // derivative of embedding energy contributions
-                double fac{-2 * q / re * xi_sq *
-                           std::exp(-2 * q * (distance / re - 1.0))};
-
-                // pair force
-                Eigen::Array3d pair_force{
-                    (d_repulsive_energy +
-                     fac * (d_embedding_density_i + d_embedding_density_j)) *
-                    distance_vector.normalized()};
+    // embedding energy and derivative of sqrt(density)
+    ClusterArray embedding{-density.sqrt()};
+    ClusterArray d_embedding_density{
+        (density > 0).select(1 / (2 * embedding), 0)};
 
-                // sum per-atom energies
-                repulsive_energy *= 0.5;
-                energies(i) += repulsive_energy;
-                energies(j) += repulsive_energy;
+    // compute forces in cluster order
+    ClusterArray energies{embedding};
+    ClusterArray forces{ClusterArray::Zero(N, 3 * nb_clusters)};
+    for (auto [I, J] : cluster_pair_list) {
+        distances(I, J, distance_vector, distance_sq, mask);
+        Block distance{distance_sq.sqrt()};
 
-                // sum per-atom forces
-                atoms.forces.col(i) -= pair_force;
-                atoms.forces.col(j) += pair_force;
+        // repulsive energy and derivative of it with respect to distance
+        Block repulsive_energy{
+            mask.select(2 * A * (-p * (distance / re - 1.0)).exp(), 0)};
+        Block d_repulsive_energy{-repulsive_energy * p / re};
+
+        // derivative of embedding energy contributions
+        Block fac{-2 * q / re * xi_sq * (-2 * q * (distance / re - 1.0)).exp()};
+
+        // pair force divided by distance
+        Block pair_force{mask.select(
+            (d_repulsive_energy +
+             fac * (d_embedding_density.col(I).replicate(1, N) +
+                    d_embedding_density.col(J).transpose().replicate(N, 1))) /
+                distance,
+            0)};
+
+        // sum per-atom energies
+        energies.col(I) += 0.5 * repulsive_energy.rowwise().sum();
+        energies.col(J) += 0.5 * repulsive_energy.colwise().sum().transpose();
+
+        // sum per-atom forces
+        for (int dim{0}; dim < 3; ++dim) {
+            Block force_component{pair_force * distance_vector[dim]};
+            forces.col(3 * I + dim) -= force_component.rowwise().sum();
+            forces.col(3 * J + dim) +=
+                force_component.colwise().sum().transpose();
+        }
+    }
+
+    // scatter energies and forces back to the atoms; padding atoms are
+    // dropped
+    atoms.forces.setZero();
+    atoms.energies.setZero(atoms.nb_atoms());
+    double energy{0};
+    for (int I{0}; I < nb_clusters; ++I) {
+        Column cluster_energies{energies.col(I)};
+        auto cluster_atoms{cluster_pair_list.cluster_atoms(I)};
+        for (int k{0}; k < N; ++k) {
+            const int i{cluster_atoms(k)};
+            if (i >= 0) {
+                atoms.energies(i) = cluster_energies(k);
+                energy += cluster_energies(k);
+                for (int dim{0}; dim < 3; ++dim)
+                    atoms.forces(dim, i) = forces(k, 3 * I + dim);
             }
         }
     }
 
     // Return total potential energy
-    return energies.sum();
+    return energy;
 }
+
+template double ducastelle<4>(Atoms &, const ClusterPairList<4> &, double,
+                              double, double, double, double, double);
+template double ducastelle<8>(Atoms &, const ClusterPairList<8> &, double,
+                              double, double, double, double, double);
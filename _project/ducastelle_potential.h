@@ -0,0 +1,79 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_DUCASTELLE_POTENTIAL_H
+#define YAMD_DUCASTELLE_POTENTIAL_H
+
+#include <cmath>
+
+#include "atoms.h"
+#include "ducastelle.h"
+#include "potential.h"
+
+/*
+ * The Ducastelle potential (see `ducastelle`) as a term of the `Potential`
+ * interface, such that it can be combined with other potentials in a
+ * `PotentialSum`. Unlike `ducastelle`, the pair loops are serial.
+ */
+class Ducastelle : public Potential<Ducastelle> {
+  public:
+    static constexpr bool has_density{true};
+
+    explicit Ducastelle(double cutoff = 10.0, double A = 0.2061,
+                        double xi = 1.790, double p = 10.229, double q = 4.036,
+                        double re = 4.079 / sqrt(2))
+        : cutoff_{cutoff}, pair_{A, xi * xi, p, q, re} {}
+
+    double cutoff() const { return cutoff_; }
+
+    void reset(const Atoms &atoms) { density_.setZero(atoms.nb_atoms()); }
+
+    void accumulate_density(int i, int j, double distance) {
+        const double density_contribution{pair_.density(distance)};
+        density_(i) += density_contribution;
+        density_(j) += density_contribution;
+    }
+
+    void finalize_density(Atoms &atoms) {
+        atoms.energies += ducastelle_embedding(density_, d_embedding_);
+    }
+
+    double accumulate(int i, int j, double distance, double &d_energy) {
+        // The pair energy is the repulsive energy of both atoms
+        const double repulsive_energy{pair_.repulsive_energy(distance)};
+        d_energy += 2 * pair_.d_repulsive_energy(repulsive_energy) +
+                    pair_.d_density(pair_.density(distance)) *
+                        (d_embedding_(i) + d_embedding_(j));
+        return 2 * repulsive_energy;
+    }
+
+  protected:
+    double cutoff_;
+    DucastelleParameters::Pair pair_;
+
+    // Densities and derivatives of the embedding energy of all atoms
+    Eigen::ArrayXd density_, d_embedding_;
+};
+
+#endif  // YAMD_DUCASTELLE_POTENTIAL_H
@@ -0,0 +1,332 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <array>
+#include <cmath>
+#include <fstream>
+
+#include "eam.h"
+
+UniformCubicSpline::UniformCubicSpline(double x0, double dx,
+                                       const Eigen::ArrayXd &values)
+    : x0_{x0}, dx_{dx}, inverse_dx_{1 / dx} {
+    const int nb_pts{static_cast<int>(values.size())};
+    if (nb_pts < 2) {
+        throw std::runtime_error("Spline needs at least two grid points.");
+    }
+
+    // Second derivatives at the grid points; they vanish at both ends
+    // (natural spline). The tridiagonal system is solved with the Thomas
+    // algorithm.
+    Eigen::ArrayXd second_derivatives{Eigen::ArrayXd::Zero(nb_pts)};
+    if (nb_pts > 2) {
+        const int n{nb_pts - 2};
+        Eigen::ArrayXd diagonal(n), rhs(n);
+        for (int k{0}; k < n; ++k) {
+            diagonal(k) = 4;
+            rhs(k) = 6 * (values(k + 2) - 2 * values(k + 1) + values(k)) /
+                     (dx * dx);
+        }
+        for (int k{1}; k < n; ++k) {
+            const double factor{1 / diagonal(k - 1)};
+            diagonal(k) -= factor;
+            rhs(k) -= factor * rhs(k - 1);
+        }
+        second_derivatives(n) = rhs(n - 1) / diagonal(n - 1);
+        for (int k{n - 2}; k >= 0; --k) {
+            second_derivatives(k + 1) =
+                (rhs(k) - second_derivatives(k + 2)) / diagonal(k);
+        }
+    }
+
+    // Polynomial coefficients in t = (x - x_k) / dx
+    coefficients_.resize(4, nb_pts - 1);
+    const double dx_sq{dx * dx};
+    for (int k{0}; k < nb_pts - 1; ++k) {
+        const double m0{second_derivatives(k)}, m1{second_derivatives(k + 1)};
+        coefficients_(0, k) = values(k);
+        coefficients_(1, k) =
+            values(k + 1) - values(k) - dx_sq / 6 * (2 * m0 + m1);
+        coefficients_(2, k) = dx_sq / 2 * m0;
+        coefficients_(3, k) = dx_sq / 6 * (m1 - m0);
+    }
+
+    end_value_ = values(nb_pts - 1);
+    auto c{coefficients_.col(nb_pts - 2)};
+    end_derivative_ = (c(1) + 2 * c(2) + 3 * c(3)) * inverse_dx_;
+}
+
+EAMPotential::EAMPotential(const std::vector<std::string> &elements,
+                           double drho, double dr, double cutoff,
+                           const std::vector<Eigen::ArrayXd> &embedding,
+                           const std::vector<Eigen::ArrayXd> &density,
+                           const std::vector<Eigen::ArrayXd> &r_times_pair)
+    : elements_{elements}, cutoff_{cutoff} {
+    const size_t nb_elements{elements.size()};
+    if (embedding.size() != nb_elements || density.size() != nb_elements ||
+        r_times_pair.size() != nb_elements * (nb_elements + 1) / 2) {
+        throw std::runtime_error("Number of EAM tables does not match number "
+                                 "of elements.");
+    }
+    for (auto &values : embedding)
+        embedding_.emplace_back(0, drho, values);
+    for (auto &values : density)
+        density_.emplace_back(0, dr, values);
+    for (auto &values : r_times_pair)
+        r_times_pair_.emplace_back(0, dr, values);
+}
+
+/*
+ * Read `nb_values` whitespace separated numbers
+ */
+static Eigen::ArrayXd read_table(std::istream &stream, int nb_values) {
+    Eigen::ArrayXd values(nb_values);
+    for (int k{0}; k < nb_values; ++k) {
+        if (!(stream >> values(k))) {
+            throw std::runtime_error("EAM file ends prematurely.");
+        }
+    }
+    return values;
+}
+
+EAMPotential EAMPotential::read_setfl(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file");
+    }
+    return read_setfl(file);
+}
+
+EAMPotential EAMPotential::read_setfl(std::istream &file) {
+    // Three comment lines
+    std::string line;
+    for (int k{0}; k < 3; ++k)
+        std::getline(file, line);
+
+    // Elements and grids
+    int nb_elements;
+    file >> nb_elements;
+    std::vector<std::string> elements(nb_elements);
+    for (auto &element : elements)
+        file >> element;
+    int nb_rho, nb_r;
+    double drho, dr, cutoff;
+    file >> nb_rho >> drho >> nb_r >> dr >> cutoff;
+    if (!file) {
+        throw std::runtime_error("Could not read header of EAM file.");
+    }
+
+    // Embedding energies and densities of each element
+    std::vector<Eigen::ArrayXd> embedding, density, r_times_pair;
+    for (int a{0}; a < nb_elements; ++a) {
+        int atomic_number;
+        double mass, lattice_constant;
+        std::string lattice_type;
+        file >> atomic_number >> mass >> lattice_constant >> lattice_type;
+        embedding.push_back(read_table(file, nb_rho));
+        density.push_back(read_table(file, nb_r));
+    }
+
+    // Pair potentials
+    for (int k{0}; k < nb_elements * (nb_elements + 1) / 2; ++k)
+        r_times_pair.push_back(read_table(file, nb_r));
+
+    return EAMPotential(elements, drho, dr, cutoff, embedding, density,
+                        r_times_pair);
+}
+
+EAMPotential EAMPotential::read_funcfl(const std::string &filename,
+                                       const std::string &element) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file");
+    }
+    return read_funcfl(file, element);
+}
+
+EAMPotential EAMPotential::read_funcfl(std::istream &file,
+                                       const std::string &element) {
+    // Comment line
+    std::string line;
+    std::getline(file, line);
+
+    int atomic_number, nb_rho, nb_r;
+    double mass, lattice_constant, drho, dr, cutoff;
+    std::string lattice_type;
+    file >> atomic_number >> mass >> lattice_constant >> lattice_type;
+    file >> nb_rho >> drho >> nb_r >> dr >> cutoff;
+    if (!file) {
+        throw std::runtime_error("Could not read header of EAM file.");
+    }
+
+    Eigen::ArrayXd embedding{read_table(file, nb_rho)};
+    Eigen::ArrayXd charge{read_table(file, nb_r)};
+    Eigen::ArrayXd density{read_table(file, nb_r)};
+
+    // The effective charge Z is given in units of sqrt(Hartree * Bohr)
+    Eigen::ArrayXd r_times_pair{27.2 * 0.529 * charge.square()};
+
+    return EAMPotential({element}, drho, dr, cutoff, {embedding}, {density},
+                        {r_times_pair});
+}
+
+Eigen::ArrayXi EAMPotential::element_indices(const Names_t &names) const {
+    Eigen::ArrayXi indices(names.size());
+    for (size_t i{0}; i < names.size(); ++i) {
+        auto element{std::find(elements_.begin(), elements_.end(), names[i])};
+        if (element == elements_.end()) {
+            throw std::runtime_error("Element " + names[i] +
+                                     " is not described by the EAM "
+                                     "potential.");
+        }
+        indices(i) = static_cast<int>(element - elements_.begin());
+    }
+    return indices;
+}
+
+/*
+ * Compute energies and forces, and the virial if `virial` is not null
+ */
+static double eam(Atoms &atoms, const NeighborList &neighbor_list,
+                  const EAMPotential &potential, Virial *virial) {
+    const double cutoff{potential.cutoff()};
+    const double cutoff_sq{cutoff * cutoff};
+
+    // The types of the atoms are indices into `potential.elements()`
+    const Eigen::ArrayXi &element{atoms.types};
+    const int nb_elements{static_cast<int>(potential.elements().size())};
+    if (element.size() != static_cast<Eigen::Index>(atoms.nb_atoms()))
+        throw std::runtime_error("The number of atom types does not match the "
+                                 "number of atoms.");
+    if (element.size() > 0 &&
+        (element.minCoeff() < 0 || element.maxCoeff() >= nb_elements))
+        throw std::runtime_error("Atom type is not described by the EAM "
+                                 "potential.");
+
+    atoms.forces.setZero();
+
+    // The first pass accumulates densities and pair energies. The
+    // derivatives that the second pass needs are stored in the order in
+    // which pairs within the cutoff are visited: the derivative of the
+    // pair potential and of the densities that j contributes to i and i
+    // contributes to j.
+    Eigen::ArrayXd density{Eigen::ArrayXd::Zero(atoms.nb_atoms())};
+    Eigen::ArrayXd energies{Eigen::ArrayXd::Zero(atoms.nb_atoms())};
+    std::vector<std::array<double, 3>> d_pair_energies;
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        Eigen::Array3d position_i{atoms.positions.col(i)};
+        const int a{element(i)};
+        for (int j : neighbor_list.neighbors(i)) {
+            if (!neighbor_list.is_pair_entry(i, j))
+                continue;
+            Eigen::Array3d distance_vector{neighbor_list.minimum_image(
+                position_i - atoms.positions.col(j))};
+            auto distance_sq{distance_vector.square().sum()};
+            if (distance_sq < cutoff_sq) {
+                const double distance{std::sqrt(distance_sq)};
+                const int b{element(j)};
+
+                // density at i due to j and at j due to i
+                auto [density_ij, d_density_ij]{
+                    potential.density(b).evaluate(distance)};
+                auto [density_ji, d_density_ji]{
+                    a == b ? std::make_tuple(density_ij, d_density_ij)
+                           : potential.density(a).evaluate(distance)};
+                density(i) += density_ij;
+                density(j) += density_ji;
+
+                // pair energy, split evenly between both atoms
+                auto [r_times_pair, d_r_times_pair]{
+                    potential.r_times_pair(a, b).evaluate(distance)};
+                const double pair_energy{r_times_pair / distance};
+                energies(i) += 0.5 * pair_energy;
+                energies(j) += 0.5 * pair_energy;
+
+                d_pair_energies.push_back(
+                    {(d_r_times_pair - pair_energy) / distance, d_density_ij,
+                     d_density_ji});
+            }
+        }
+    }
+
+    // embedding energies and their derivatives
+    Eigen::ArrayXd d_embedding(atoms.nb_atoms());
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        auto [embedding, d_embedding_i]{
+            potential.embedding(element(i)).evaluate(density(i))};
+        energies(i) += embedding;
+        d_embedding(i) = d_embedding_i;
+    }
+
+    if (virial)
+        virial->reset(atoms.nb_atoms());
+
+    // The second pass computes the forces
+    size_t pair{0};
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        Eigen::Array3d position_i{atoms.positions.col(i)};
+        const double d_embedding_i{d_embedding(i)};
+
+        // forces on atom i are accumulated locally
+        Eigen::Array3d force_i{Eigen::Array3d::Zero()};
+        for (int j : neighbor_list.neighbors(i)) {
+            if (!neighbor_list.is_pair_entry(i, j))
+                continue;
+            Eigen::Array3d distance_vector{neighbor_list.minimum_image(
+                position_i - atoms.positions.col(j))};
+            auto distance_sq{distance_vector.square().sum()};
+            if (distance_sq < cutoff_sq) {
+                auto [d_pair_energy, d_density_ij,
+                      d_density_ji]{d_pair_energies[pair++]};
+
+                // pair force
+                Eigen::Array3d pair_force{
+                    (d_pair_energy + d_embedding_i * d_density_ij +
+                     d_embedding(j) * d_density_ji) /
+                    std::sqrt(distance_sq) * distance_vector};
+
+                force_i -= pair_force;
+                atoms.forces.col(j) += pair_force;
+
+                if (virial)
+                    virial->add_pair(i, j, distance_vector, pair_force);
+            }
+        }
+        atoms.forces.col(i) += force_i;
+    }
+
+    // Store per-atom energies and return total potential energy
+    atoms.energies = energies;
+    return energies.sum();
+}
+
+double eam(Atoms &atoms, const NeighborList &neighbor_list,
+           const EAMPotential &potential) {
+    return eam(atoms, neighbor_list, potential, nullptr);
+}
+
+double eam(Atoms &atoms, const NeighborList &neighbor_list,
+           const EAMPotential &potential, Virial &virial) {
+    return eam(atoms, neighbor_list, potential, &virial);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_EAM_H
+#define YAMD_EAM_H
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "atoms.h"
+#include "neighbors.h"
+#include "virial.h"
+
+/*
+ * Natural cubic spline through values tabulated on the uniform grid
+ * x0, x0 + dx, x0 + 2 dx, ... Beyond the last grid point the spline is
+ * continued linearly.
+ */
+class UniformCubicSpline {
+  public:
+    UniformCubicSpline() = default;
+    UniformCubicSpline(double x0, double dx, const Eigen::ArrayXd &values);
+
+    /*
+     * Return value and derivative of the spline at `x`
+     */
+    std::tuple<double, double> evaluate(double x) const {
+        double u{(x - x0_) * inverse_dx_};
+        const int nb_intervals{static_cast<int>(coefficients_.cols())};
+        if (u >= nb_intervals) {
+            return {end_value_ + end_derivative_ * (u - nb_intervals) * dx_, end_derivative_};
+        }
+        const int k{std::max(static_cast<int>(u), 0)};
+        const double t{u - k};
+        auto c{coefficients_.col(k)};
+        return {c(0) + t * (c(1) + t * (c(2) + t * c(3))), (c(1) + t * (2 * c(2) + t * 3 * c(3))) * inverse_dx_};
+    }
+
+    double operator()(double x) const { return std::get<0>(evaluate(x)); }
+
+  protected:
+    double x0_{0}, dx_{1}, inverse_dx_{1};
+
+    // Coefficients of the cubic polynomial in t = (x - x_k) / dx on each
+    // interval k
+    Eigen::Array4Xd coefficients_;
+
+    // Value and derivative at the last grid point
+    double end_value_{0}, end_derivative_{0};
+};
+
+/*
+ * Tabulated embedded atom method potential. The energy is
+ *     E = sum_i F_a(rho_i) + 1/2 sum_i sum_j phi_ab(r_ij),
+ *     rho_i = sum_j rho_b(r_ij),
+ * where a and b are the elements of atoms i and j. The embedding functions
+ * F_a, densities rho_a and pair potentials phi_ab are cubic splines. Energies
+ * are in eV and distances in Å.
+ */
+class EAMPotential {
+  public:
+    /*
+     * Construct from tables on uniform grids that start at zero. The pair
+     * potentials are tabulated as r * phi_ab(r) for all pairs a >= b in the
+     * order (0, 0), (1, 0), (1, 1), (2, 0), ...
+     */
+    EAMPotential(const std::vector<std::string> &elements, double drho, double dr, double cutoff,
+                 const std::vector<Eigen::ArrayXd> &embedding, const std::vector<Eigen::ArrayXd> &density,
+                 const std::vector<Eigen::ArrayXd> &r_times_pair);
+
+    /*
+     * Read a potential in the multi-element setfl format. Its structure is
+     *     lines 1-3: comments
+     *     line 4: number of elements, followed by the element names
+     *     line 5: Nrho drho Nr dr cutoff
+     *     for each element:
+     *         atomic number, mass, lattice constant, lattice type
+     *         Nrho values of F(rho)
+     *         Nr values of rho(r)
+     *     for each pair of elements a >= b: Nr values of r * phi_ab(r)
+     * The tables can be wrapped onto any number of lines.
+     */
+    static EAMPotential read_setfl(const std::string &filename);
+    static EAMPotential read_setfl(std::istream &stream);
+
+    /*
+     * Read a single-element potential in the DYNAMO funcfl format. Its
+     * structure is
+     *     line 1: comment
+     *     line 2: atomic number, mass, lattice constant, lattice type
+     *     line 3: Nrho drho Nr dr cutoff
+     *     Nrho values of F(rho), Nr values of Z(r), Nr values of rho(r)
+     * The pair potential is phi(r) = 27.2 * 0.529 * Z(r)^2 / r. The file
+     * does not contain the name of the element, which is hence passed
+     * explicitly.
+     */
+    static EAMPotential read_funcfl(const std::string &filename, const std::string &element);
+    static EAMPotential read_funcfl(std::istream &stream, const std::string &element);
+
+    double cutoff() const { return cutoff_; }
+
+    const std::vector<std::string> &elements() const { return elements_; }
+
+    /*
+     * Return the index of every atom's element in `elements()`. Use this to
+     * set `atoms.types` once, before computing energies and forces.
+     */
+    Eigen::ArrayXi element_indices(const Names_t &names) const;
+
+    const UniformCubicSpline &embedding(int a) const { return embedding_[a]; }
+
+    const UniformCubicSpline &density(int a) const { return density_[a]; }
+
+    const UniformCubicSpline &r_times_pair(int a, int b) const {
+        return a >= b ? r_times_pair_[a * (a + 1) / 2 + b] : r_times_pair_[b * (b + 1) / 2 + a];
+    }
+
+  protected:
+    std::vector<std::string> elements_;
+    double cutoff_;
+    std::vector<UniformCubicSpline> embedding_, density_, r_times_pair_;
+};
+
+/*
+ * Compute energies and forces of the tabulated EAM potential. The element of
+ * each atom is given by its type in `atoms.types`, an index into
+ * `potential.elements()`; throws if the types do not match the number of
+ * atoms or the potential. The neighbor list can be a full or a half list and
+ * may be periodic; it must have been built with a cutoff of at least
+ * `potential.cutoff()`. Per-atom energies are stored in `atoms.energies`.
+ */
+double eam(Atoms &atoms, const NeighborList &neighbor_list, const EAMPotential &potential);
+
+/*
+ * Same potential, also computing the virial (see `Virial`) in the loop that
+ * computes the forces
+ */
+double eam(Atoms &atoms, const NeighborList &neighbor_list, const EAMPotential &potential, Virial &virial);
+
+#endif  // YAMD_EAM_H
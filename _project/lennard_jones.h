@@ -0,0 +1,70 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_LENNARD_JONES_H
+#define YAMD_LENNARD_JONES_H
+
+#include <cmath>
+
+#include "atoms.h"
+#include "potential.h"
+
+/*
+ * Flat Lennard-Jones substrate at height `z0`, obtained by integrating the
+ * Lennard-Jones potential over a half space. An atom at height z > z0
+ * interacts with it through
+ *     V(h) = epsilon [2/15 (sigma / h)^9 - (sigma / h)^3],   h = z - z0,
+ * truncated at `wall_cutoff` and shifted such that it vanishes there. All
+ * atoms must lie above the wall. The wall does not contribute pairs; it adds
+ * its energies and forces in `finalize`.
+ */
+class LennardJonesWall : public Potential<LennardJonesWall> {
+  public:
+    LennardJonesWall(double epsilon, double sigma, double z0,
+                     double wall_cutoff)
+        : epsilon_{epsilon}, sigma_{sigma}, z0_{z0},
+          wall_cutoff_{wall_cutoff}, shift_{_energy(wall_cutoff)} {}
+
+    void finalize(Atoms &atoms) {
+        for (int i{0}; i < atoms.nb_atoms(); ++i) {
+            const double h{atoms.positions(2, i) - z0_};
+            if (h < wall_cutoff_) {
+                const double sh3{std::pow(sigma_ / h, 3)};
+                atoms.energies(i) += _energy(h) - shift_;
+                atoms.forces(2, i) +=
+                    epsilon_ * (6.0 / 5 * sh3 * sh3 * sh3 - 3 * sh3) / h;
+            }
+        }
+    }
+
+  protected:
+    double _energy(double h) const {
+        const double sh3{std::pow(sigma_ / h, 3)};
+        return epsilon_ * (2.0 / 15 * sh3 * sh3 * sh3 - sh3);
+    }
+
+    double epsilon_, sigma_, z0_, wall_cutoff_, shift_;
+};
+
+#endif  // YAMD_LENNARD_JONES_H
@@ -23,17 +23,183 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
 #include <numeric>
 
 #include "neighbors.h"
+#include "openmp_support.h"
 
-NeighborList::NeighborList() : seed_{1}, neighbors_{1} {}
+/*
+ * Number of cells per Cartesian direction is limited such that the cell
+ * coordinates of a sparse grid can be packed into a 64-bit key
+ */
+static constexpr int max_grid_pts{1 << 21};
+
+static uint64_t pack_cell_coordinates(int x, int y, int z) {
+    return static_cast<uint64_t>(x) | static_cast<uint64_t>(y) << 21 |
+           static_cast<uint64_t>(z) << 42;
+}
+
+/*
+ * Open-addressing hash table (with linear probing) that maps the packed
+ * coordinates of occupied cells onto a contiguous cell index
+ */
+class CellHashTable {
+  public:
+    explicit CellHashTable(const std::vector<uint64_t> &keys) {
+        size_t capacity{16};
+        while (capacity < 2 * keys.size())
+            capacity *= 2;
+        mask_ = capacity - 1;
+        keys_.assign(capacity, empty_);
+        values_.resize(capacity);
+        for (size_t n{0}; n < keys.size(); ++n) {
+            size_t slot{find(keys[n])};
+            keys_[slot] = keys[n];
+            values_[slot] = static_cast<int>(n);
+        }
+    }
+
+    // Return the index of the cell, or -1 if the cell is empty
+    int operator()(uint64_t key) const {
+        size_t slot{find(key)};
+        return keys_[slot] == empty_ ? -1 : values_[slot];
+    }
+
+  protected:
+    // Return slot that contains `key` or the empty slot where it belongs
+    size_t find(uint64_t key) const {
+        size_t slot{(key * 0x9e3779b97f4a7c15) >> 20 & mask_};
+        while (keys_[slot] != key && keys_[slot] != empty_)
+            slot = (slot + 1) & mask_;
+        return slot;
+    }
+
+    // Packed keys use only 63 bits
+    static constexpr uint64_t empty_{~uint64_t{0}};
+
+    size_t mask_;
+    std::vector<uint64_t> keys_;
+    std::vector<int> values_;
+};
+
+NeighborList::NeighborList(Storage storage, int bins_per_cutoff,
+                           bool sort_by_distance)
+    : storage_{storage}, bins_per_cutoff_{bins_per_cutoff},
+      sort_by_distance_{sort_by_distance}, seed_{1}, neighbors_{1}, cutoff_{0}, skin_{0},
+      domain_length_{Eigen::Array3d::Zero()},
+      periodicity_{Eigen::Array3i::Zero()}, is_periodic_{false},
+      periodic_length_{Eigen::Array3d::Zero()},
+      inverse_periodic_length_{Eigen::Array3d::Zero()}, nb_local_{0},
+      reference_positions_{3, 0} {}
+
+bool NeighborList::needs_update(const Atoms &atoms, double cutoff,
+                                double skin) const {
+    return needs_update(atoms, cutoff, skin, Eigen::Array3d::Zero(),
+                        Eigen::Array3i::Zero());
+}
+
+bool NeighborList::needs_update(const Atoms &atoms, double cutoff, double skin,
+                                const Eigen::Array3d &domain_length,
+                                const Eigen::Array3i &periodicity) const {
+    // The list has never been built or was built for a different system,
+    // interaction range or domain.
+    if (seed_.size() != atoms.nb_atoms() + 1 || cutoff != cutoff_ ||
+        skin != skin_ || (periodicity != periodicity_).any() ||
+        (domain_length != domain_length_).any())
+        return true;
+
+    // Two atoms moving towards each other by half of the skin distance each
+    // can just come within the cutoff. We hence need to rebuild once any atom
+    // has moved more than half of the skin.
+    auto max_displacement_sq{
+        (atoms.positions - reference_positions_).colwise().squaredNorm()
+            .maxCoeff()};
+    return max_displacement_sq > skin * skin / 4;
+}
+
+bool NeighborList::update_if_needed(const Atoms &atoms, double cutoff,
+                                    double skin) {
+    return update_if_needed(atoms, cutoff, skin, Eigen::Array3d::Zero(),
+                            Eigen::Array3i::Zero());
+}
+
+bool NeighborList::update_if_needed(const Atoms &atoms, double cutoff,
+                                    double skin,
+                                    const Eigen::Array3d &domain_length,
+                                    const Eigen::Array3i &periodicity) {
+    if (!needs_update(atoms, cutoff, skin, domain_length, periodicity))
+        return false;
+    update(atoms, cutoff, domain_length, periodicity, skin);
+    return true;
+}
+
+const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+NeighborList::update(const Atoms &atoms, double cutoff, double skin) {
+    return update(atoms, cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero(),
+                  skin);
+}
+
+const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+NeighborList::update(const Atoms &atoms, double cutoff,
+                     const Eigen::Array3d &domain_length,
+                     const Eigen::Array3i &periodicity, double skin) {
+    return _update(atoms, cutoff, domain_length, periodicity, skin,
+                   atoms.nb_atoms(), 0);
+}
 
 const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
-NeighborList::update(const Atoms &atoms, double cutoff) {
+NeighborList::update(const Atoms &atoms, double cutoff, double skin,
+                     int nb_local, int nb_ghost_shells) {
+    return _update(atoms, cutoff, Eigen::Array3d::Zero(),
+                   Eigen::Array3i::Zero(), skin, nb_local, nb_ghost_shells);
+}
+
+const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+NeighborList::_update(const Atoms &atoms, double cutoff,
+                      const Eigen::Array3d &domain_length,
+                      const Eigen::Array3i &periodicity, double skin,
+                      int nb_local, int nb_ghost_shells) {
     // Shorthand for atoms.positions.
     auto &&r{atoms.positions};
 
+    if (nb_local < 0 || nb_local > atoms.nb_atoms()) {
+        throw std::runtime_error("Number of local atoms exceeds number of atoms.");
+    }
+
+    // Remember the state for which this list was built.
+    cutoff_ = cutoff;
+    skin_ = skin;
+    domain_length_ = domain_length;
+    periodicity_ = periodicity;
+    nb_local_ = nb_local;
+    reference_positions_ = r;
+
+    // Pair geometry refers to the old neighbor array.
+    pair_distance_vectors_.resize(3, 0);
+    pair_distances_.resize(0);
+    pair_geometry_positions_.resize(3, 0);
+
+    // The grid for incremental updates is rebuilt when needed.
+    incremental_cells_.clear();
+    incremental_cell_of_atom_.clear();
+
+    // The list contains all pairs within the cutoff plus the skin distance.
+    // The kernels need to check the actual distance against the cutoff.
+    cutoff += skin;
+
+    // Lengths used for the minimum image convention in `distance_vector`.
+    is_periodic_ = (periodicity != 0).any();
+    periodic_length_ = (periodicity != 0).select(domain_length, 0);
+    inverse_periodic_length_ = (periodicity != 0).select(1 / domain_length, 0);
+    if ((periodicity != 0 && domain_length < 2 * cutoff).any()) {
+        throw std::runtime_error(
+            "Periodic domain is too small for the minimum image convention. "
+            "Use the `Domain` class to replicate ghost atoms instead.");
+    }
+
     // Avoid computing if atoms is empty
     if (r.size() == 0) {
       seed_.resize(0);
@@ -43,154 +209,734 @@ NeighborList::update(const Atoms &atoms, double cutoff) {
 
     // Origin stores the bottom left corner of the enclosing rectangles and
     // lengths the three Cartesian lengths.
-    Eigen::Array3d origin{3}, lengths{3}, padding_lengths{3};
+    Eigen::Array3d origin{3}, lengths{3};
 
     // This is the number of cells/grid points that fit into the enclosing
-    // rectangle. The grid is such that a sphere of diameter *cutoff* fits into
-    // each cell.
+    // rectangle. Cells are at least `cutoff / bins_per_cutoff_` wide, hence
+    // all neighbors of an atom are found within `bins_per_cutoff_` cells in
+    // each direction. (Cells are wider if there would be more than
+    // `max_grid_pts` cells in one direction.)
     Eigen::Array3i nb_grid_pts{3};
+    const int k{bins_per_cutoff_};
+    const double bin_size{cutoff / k};
+
+    for (int dim{0}; dim < 3; ++dim) {
+        if (periodicity(dim)) {
+            // In periodic directions, the grid spans the domain.
+            origin(dim) = 0;
+            lengths(dim) = domain_length(dim);
+            nb_grid_pts(dim) = static_cast<int>(std::min<double>(
+                std::floor(domain_length(dim) / bin_size), max_grid_pts));
+        } else {
+            // Compute box that encloses all atomic positions. Make sure that
+            // box lengths are exactly divisible by the bin size. Also compute
+            // the number of cells in this Cartesian direction.
+            origin(dim) = r.row(dim).minCoeff();
+            lengths(dim) = r.row(dim).maxCoeff() - origin(dim);
+            nb_grid_pts(dim) = static_cast<int>(std::min<double>(
+                std::ceil(lengths(dim) / bin_size), max_grid_pts));
+
+            // Set to 1 if all atoms are in-plane
+            nb_grid_pts(dim) = std::max(nb_grid_pts(dim), 1);
+
+            // Pad
+            double padding_length{
+                nb_grid_pts(dim) *
+                    std::max(bin_size, lengths(dim) / nb_grid_pts(dim)) -
+                lengths(dim)};
+            origin(dim) -= padding_length / 2;
+            lengths(dim) += padding_length;
+        }
+    }
+    Eigen::Array3d cell_lengths{lengths / nb_grid_pts.cast<double>()};
+
+    // Compute cell coordinates of each atom. In periodic directions, atoms
+    // outside of the domain are wrapped back into it. Atoms that sit exactly
+    // on the upper boundary of the enclosing rectangle are put into the last
+    // cell.
+    Eigen::Array3Xd scaled_positions{(r.colwise() - origin).colwise() /
+                                     lengths};
+    for (int dim{0}; dim < 3; ++dim) {
+        if (periodicity(dim)) {
+            scaled_positions.row(dim) -= scaled_positions.row(dim).floor();
+        }
+    }
+    Eigen::Array3Xi cell_coords{
+        (scaled_positions.colwise() * nb_grid_pts.cast<double>())
+            .floor()
+            .cast<int>()};
+    for (int dim{0}; dim < 3; ++dim) {
+        cell_coords.row(dim) =
+            cell_coords.row(dim).max(0).min(nb_grid_pts(dim) - 1);
+    }
 
-    // Compute box that encloses all atomic positions. Make sure that box
-    // lengths are exactly divisible by the interaction range. Also compute the
-    // number of cells in each Cartesian direction.
-    origin = r.rowwise().minCoeff();
-    lengths = r.rowwise().maxCoeff() - origin;
-    nb_grid_pts = (lengths / cutoff).ceil().cast<int>();
-
-    // Set to 1 if all atoms are in-plane
-    nb_grid_pts = (nb_grid_pts <= 0).select(1, nb_grid_pts);
+    // A dense grid stores all cells of the enclosing rectangle. If atoms are
+    // spread out, e.g. because a single atom evaporated from a cluster, most
+    // of these cells are empty. We then only store the occupied cells and
+    // look them up in a hash table. Occupied cells are numbered in the order
+    // of their dense cell index, hence neighboring cells along x are still
+    // adjacent.
+    const bool sparse{nb_grid_pts.cast<double>().prod() >
+                      8.0 * atoms.nb_atoms()};
+    std::vector<uint64_t> occupied_cells;
+    if (sparse) {
+        occupied_cells.resize(atoms.nb_atoms());
+        for (int i{0}; i < atoms.nb_atoms(); ++i) {
+            occupied_cells[i] = pack_cell_coordinates(
+                cell_coords(0, i), cell_coords(1, i), cell_coords(2, i));
+        }
+        std::sort(occupied_cells.begin(), occupied_cells.end());
+        occupied_cells.erase(
+            std::unique(occupied_cells.begin(), occupied_cells.end()),
+            occupied_cells.end());
+    }
+    CellHashTable cell_hash_table{occupied_cells};
 
-    // Pad
-    padding_lengths = nb_grid_pts.cast<double>() * cutoff - lengths;
-    origin -= padding_lengths / 2;
-    lengths += padding_lengths;
+    // Return the index of the cell at the given coordinates, or -1 if this
+    // cell is not stored because it is empty.
+    auto cell_index_at = [&](int x, int y, int z) {
+        if (sparse) {
+            return cell_hash_table(pack_cell_coordinates(x, y, z));
+        }
+        return coordinate_to_index(x, y, z, nb_grid_pts);
+    };
 
     // Compute cell indices. The follow array contains the cell index for each
     // atom.
-    Eigen::ArrayXi atom_to_cell{
-        coordinate_to_index(((r.colwise() - origin).colwise() *
-                             (nb_grid_pts.cast<double>() / lengths))
-                                .floor()
-                                .cast<int>(),
-                            nb_grid_pts)};
-
-    // We now sort the cell indices. This will allow us to search for the atoms
-    // that sit in neighboring cells.
-    Eigen::ArrayXi sorted_atom_indices{atom_to_cell.size()};
-
-    // Fill array `sorted_atom_indices` with consecutive numbers, i.e. 0, 1, 2,
-    // 3, 4, 5, ...
-    std::iota(sorted_atom_indices.begin(), sorted_atom_indices.end(), 0);
-
-    // Sort the array `sorted_atom_indices` by cell index. This yields an array
-    // of atom indices, but now sorted by cell, i.e. all atoms within cell 0 are
-    // at the beginning of the array, followed by all atoms in cell 1 etc..
+    Eigen::ArrayXi atom_to_cell(atoms.nb_atoms());
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        atom_to_cell(i) =
+            cell_index_at(cell_coords(0, i), cell_coords(1, i), cell_coords(2, i));
+    }
+
+    // We now sort the atoms by cell index. This will allow us to search for
+    // the atoms that sit in neighboring cells. Since cell indices are bounded
+    // integers, we can do this with a counting sort in linear time. The result
+    // is an array of atom indices, sorted by cell, i.e. all atoms within cell 0
+    // are at the beginning of the array, followed by all atoms in cell 1 etc.,
+    // and an array that points to the first entry of each cell.
     // Example:
-    //     sorted_atom_indices:                2 4 9 6 7 8 0 1 3 9
+    //     sorted_atom_indices:                2 4 5 6 7 8 0 1 3 9
     //     atom_to_cell(sorted_atom_indices):  0 0 0 0 1 1 1 2 2 3
     //                                         ^       ^     ^   ^
     //     cell_index:                         0       1     2   3
-    //     entry_index:                        0       4     7   9
-    std::sort(sorted_atom_indices.begin(), sorted_atom_indices.end(),
-              [&](int i, int j) { return atom_to_cell[i] < atom_to_cell[j]; });
-
-    // We now build an array that points to the first entry within a certain
-    // cell in the `sorted_atom_indices` array. We use a std::vector because we
-    // need to dynamically grow this array.
-    std::vector<std::tuple<int, int>> binned_atoms{};
-    int cell_index{atom_to_cell(sorted_atom_indices(0))};
-    int entry_index{0};
-
-    // This stores the index of the first entry for each cell.
-    binned_atoms.push_back({cell_index, entry_index});
-
-    // We now loop over the sorted atom indices and check when the cell index
-    // changes.
-    for (int i{1}; i < sorted_atom_indices.size(); ++i) {
-        if (atom_to_cell(sorted_atom_indices(i)) != cell_index) {
-            cell_index = atom_to_cell(sorted_atom_indices(i));
-            entry_index = i;
-            binned_atoms.push_back({cell_index, entry_index});
-        }
-    }
-
-    // We are now in a position to build a neighbor list in linear order. We are
-    // doing a bit of optimization here. Since we have a dynamically growing
-    // list, we don't want to resize every time we add a neighbor. We are
-    // therefore doubling the size when necessary and then resizing once (to a
-    // shorter array) when the list has been build.
-    seed_.resize(atoms.nb_atoms() + 1);
+    //     cell_start(cell_index):             0       4     7   9
+    int nb_cells{sparse ? static_cast<int>(occupied_cells.size())
+                        : nb_grid_pts.prod()};
+    Eigen::ArrayXi cell_start{Eigen::ArrayXi::Zero(nb_cells + 1)};
+
+    // First pass: Count the number of atoms in each cell. We count into the
+    // entry of the next cell, such that the cumulative sum yields the index of
+    // the first entry within each cell.
+    for (auto cell_index : atom_to_cell) {
+        cell_start(cell_index + 1)++;
+    }
+    std::partial_sum(cell_start.begin(), cell_start.end(), cell_start.begin());
+
+    // Second pass: Put each atom into the next free slot of its cell. Looping
+    // over atoms in ascending order keeps the order of atoms within a cell.
+    Eigen::ArrayXi sorted_atom_indices(atom_to_cell.size());
+    Eigen::ArrayXi next_slot{cell_start.head(nb_cells)};
+    for (int i{0}; i < atom_to_cell.size(); ++i) {
+        sorted_atom_indices(next_slot(atom_to_cell(i))++) = i;
+    }
 
-    int n{0};
-    auto cutoffsq{cutoff * cutoff};
+    // The stencil contains the cells that can hold neighbors of atoms in a
+    // given cell. If a periodic direction has fewer than 2k + 1 cells, the
+    // stencil wraps onto itself and shifted cells alias each other. In this
+    // case we fall back to a cube of cells in which every cell is visited
+    // once, and a half list keeps only the pairs with i < j.
+    const bool aliased{
+        (periodicity != 0 && nb_grid_pts < 2 * k + 1).any()};
+
+    // Otherwise, the stencil only contains cells whose closest points are
+    // within the cutoff. It is stored as rows along x: For each shift (dy, dz)
+    // we store the largest shift along x. A half list uses only half of the
+    // stencil (the half shell) and visits each pair of cells once. The pair
+    // (i, j) is then stored either in the row of i or in the row of j.
+    const bool half_shell{is_half() && !aliased};
+    std::vector<std::array<int, 3>> stencil, half_stencil;  // dy, dz, largest dx
+    if (!aliased) {
+        // Allow for some round-off, which at worst adds a row of cells.
+        const double cutoff_sq_with_slack{cutoff * cutoff * (1 + 1e-12)};
+        auto gap_sq = [&](int shift, int dim) {
+            double gap{std::max(std::abs(shift) - 1, 0) * cell_lengths(dim)};
+            return gap * gap;
+        };
+        for (int dz{-k}; dz <= k; ++dz) {
+            for (int dy{-k}; dy <= k; ++dy) {
+                int dx{-1};
+                while (dx < k && gap_sq(dz, 2) + gap_sq(dy, 1) +
+                                         gap_sq(dx + 1, 0) <=
+                                     cutoff_sq_with_slack) {
+                    ++dx;
+                }
+                if (dx >= 0) {
+                    stencil.push_back({dy, dz, dx});
+                    if (dz > 0 || (dz == 0 && dy >= 0))
+                        half_stencil.push_back({dy, dz, dx});
+                }
+            }
+        }
+    }
 
-    // Constructing index shift vectors to look for neighboring cells
-    auto neighborhood = []() {
-        Eigen::Array<int, 3, 27> neighborhood;
-        auto n_it = neighborhood.colwise().begin();
-        for (int x = -1; x <= 1; ++x)
-            for (int y = -1; y <= 1; ++y)
-                for (int z = -1; z <= 1; ++z) {
-                    *n_it = Eigen::Vector3i{x, y, z};
-                    ++n_it;
+    // For each Cartesian direction and cell coordinate, determine the
+    // coordinates of the neighboring cells of the aliased stencil. Cells that
+    // are out of bounds are skipped in nonperiodic directions and wrapped in
+    // periodic ones. The coordinates are sorted and unique.
+    std::array<std::vector<std::vector<int>>, 3> neighbor_cell_coords;
+    if (aliased) {
+        for (int dim{0}; dim < 3; ++dim) {
+            neighbor_cell_coords[dim].resize(nb_grid_pts(dim));
+            for (int c{0}; c < nb_grid_pts(dim); ++c) {
+                auto &coords{neighbor_cell_coords[dim][c]};
+                for (int shift{-k}; shift <= k; ++shift) {
+                    int neigh_c{c + shift};
+                    if (periodicity(dim)) {
+                        coords.push_back(
+                            ((neigh_c % nb_grid_pts(dim)) + nb_grid_pts(dim)) %
+                            nb_grid_pts(dim));
+                    } else if (neigh_c >= 0 && neigh_c < nb_grid_pts(dim)) {
+                        coords.push_back(neigh_c);
+                    }
                 }
-        return neighborhood;
-    }();
+                std::sort(coords.begin(), coords.end());
+                coords.erase(std::unique(coords.begin(), coords.end()),
+                             coords.end());
+            }
+        }
+    }
 
-    for (int i{0}; i < atoms.nb_atoms(); ++i) {
-        seed_(i) = n;
+    // Wrap a cell coordinate in periodic directions; return -1 if it lies
+    // outside of the grid in nonperiodic directions.
+    auto wrap = [&](int c, int dim) {
+        if (periodicity(dim)) {
+            return (c + nb_grid_pts(dim)) % nb_grid_pts(dim);
+        }
+        return c >= 0 && c < nb_grid_pts(dim) ? c : -1;
+    };
+
+    // Append the atoms of the cells `first_x` to `last_x` within the row of
+    // cells at `y` and `z` to the list of ranges. Since the cell index runs
+    // fastest along x, the atoms of these cells are adjacent in
+    // `sorted_atom_indices` and form a single contiguous range. For a sparse
+    // grid, the row is interrupted by empty cells.
+    auto add_row = [&](int first_x, int last_x, int y, int z,
+                       std::vector<std::tuple<int, int>> &ranges) {
+        if (!sparse) {
+            ranges.push_back(
+                {cell_start(cell_index_at(first_x, y, z)),
+                 cell_start(cell_index_at(last_x, y, z) + 1)});
+            return;
+        }
+        int previous_cell_index{-2};
+        for (int x{first_x}; x <= last_x; ++x) {
+            int cell_index{cell_index_at(x, y, z)};
+            if (cell_index < 0)
+                continue;
+            if (cell_index == previous_cell_index + 1) {
+                std::get<1>(ranges.back()) = cell_start(cell_index + 1);
+            } else {
+                ranges.push_back(
+                    {cell_start(cell_index), cell_start(cell_index + 1)});
+            }
+            previous_cell_index = cell_index;
+        }
+    };
+
+    // We are now in a position to build the neighbor list. We loop over cells
+    // rather than over atoms: All atoms within a cell share the same
+    // neighboring cells, so we only need to walk the stencil of neighboring
+    // cells once per cell. The atoms of all neighboring cells form only a few
+    // contiguous ranges (one per row of the stencil) that we collect for each
+    // cell. For the half shell, the first row of the stencil is
+    // (dy, dz) = (0, 0), hence the first range starts at the cell itself.
+    auto collect_ranges = [&](int cell_index,
+                              std::vector<std::tuple<int, int>> &ranges,
+                              bool half) {
+        int x, y, z;
+        if (sparse) {
+            uint64_t key{occupied_cells[cell_index]};
+            x = key & (max_grid_pts - 1);
+            y = key >> 21 & (max_grid_pts - 1);
+            z = key >> 42;
+        } else {
+            x = cell_index % nb_grid_pts(0);
+            y = (cell_index / nb_grid_pts(0)) % nb_grid_pts(1);
+            z = cell_index / (nb_grid_pts(0) * nb_grid_pts(1));
+        }
+        ranges.clear();
+        if (aliased) {
+            auto &&neigh_xs{neighbor_cell_coords[0][x]};
+            for (auto neigh_z : neighbor_cell_coords[2][z]) {
+                for (auto neigh_y : neighbor_cell_coords[1][y]) {
+                    for (size_t n{0}; n < neigh_xs.size(); ++n) {
+                        int first_x{neigh_xs[n]};
+                        // Merge with the next cell if it is adjacent
+                        while (n + 1 < neigh_xs.size() &&
+                               neigh_xs[n + 1] == neigh_xs[n] + 1) {
+                            ++n;
+                        }
+                        add_row(first_x, neigh_xs[n], neigh_y, neigh_z, ranges);
+                    }
+                }
+            }
+            return;
+        }
+        for (auto [dy, dz, dx] : half ? half_stencil : stencil) {
+            int neigh_y{wrap(y + dy, 1)}, neigh_z{wrap(z + dz, 2)};
+            if (neigh_y < 0 || neigh_z < 0)
+                continue;
+            // The half shell only extends forward along x in its own row
+            int first_x{half && dy == 0 && dz == 0 ? x : x - dx};
+            int last_x{x + dx};
+            if (!periodicity(0)) {
+                first_x = std::max(first_x, 0);
+                last_x = std::min(last_x, nb_grid_pts(0) - 1);
+            }
+            // A row of cells that wraps around the periodic boundary is split
+            // into two contiguous ranges.
+            if (first_x < 0) {
+                add_row(first_x + nb_grid_pts(0), nb_grid_pts(0) - 1, neigh_y,
+                        neigh_z, ranges);
+                add_row(0, last_x, neigh_y, neigh_z, ranges);
+            } else if (last_x >= nb_grid_pts(0)) {
+                add_row(first_x, nb_grid_pts(0) - 1, neigh_y, neigh_z, ranges);
+                add_row(0, last_x - nb_grid_pts(0), neigh_y, neigh_z, ranges);
+            } else {
+                add_row(first_x, last_x, neigh_y, neigh_z, ranges);
+            }
+        }
+    };
 
-        Eigen::Array3i cell_coord{
-            (nb_grid_pts.cast<double>() * (r.col(i) - origin) / lengths)
-                .floor()
-                .cast<int>()};
+    auto cutoffsq{cutoff * cutoff};
 
-        // Loop over neighboring cells.
-        for (auto &&shift : neighborhood.colwise()) {
-            Eigen::Array3i neigh_cell_coord{cell_coord + shift.array()};
+    // Under domain decomposition, we only need the neighbors of local atoms
+    // and of the ghosts within `nb_ghost_shells` neighbor shells of them. The
+    // shells are found one after the other: A ghost belongs to shell s if it
+    // has a neighbor in shell s - 1. Local atoms are shell 0. Atoms that do
+    // not belong to one of these shells are inactive.
+    const bool all_active{nb_local == atoms.nb_atoms()};
+    Eigen::ArrayXi shell(atoms.nb_atoms());
+    shell.head(nb_local) = 0;
+    shell.tail(atoms.nb_atoms() - nb_local) = nb_ghost_shells + 1;
+    for (int s{1}; s <= nb_ghost_shells && !all_active; ++s) {
+        Eigen::ArrayXi next_shell{shell};
+#pragma omp parallel
+        {
+            std::vector<std::tuple<int, int>> ranges;
+#pragma omp for schedule(dynamic, 16)
+            for (int cell_index = 0; cell_index < nb_cells; ++cell_index) {
+                bool collected{false};
+                for (int n{cell_start(cell_index)};
+                     n < cell_start(cell_index + 1); ++n) {
+                    int i{sorted_atom_indices(n)};
+                    if (shell(i) < s)
+                        continue;
+                    if (!collected) {
+                        collect_ranges(cell_index, ranges, false);
+                        collected = true;
+                    }
+                    // Stop at the first neighbor in the previous shell
+                    for (auto [begin, end] : ranges) {
+                        for (int m{begin}; m < end && next_shell(i) > s; ++m) {
+                            int j{sorted_atom_indices(m)};
+                            if (shell(j) == s - 1 &&
+                                distance_vector(r, i, j).squaredNorm() <=
+                                    cutoffsq) {
+                                next_shell(i) = s;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        shell = next_shell;
+    }
+    auto active = [&](int i) { return shell(i) <= nb_ghost_shells; };
+
+    // Call `visit(i, j)` for all neighbors j of all atoms i within a cell.
+    // The neighbors of each atom are visited in a fixed order, independent
+    // of which thread processes the cell.
+    auto search_cell = [&](int cell_index,
+                           std::vector<std::tuple<int, int>> &ranges,
+                           auto &&visit) {
+        // Skip empty cells
+        if (cell_start(cell_index) == cell_start(cell_index + 1))
+            return;
+
+        collect_ranges(cell_index, ranges, half_shell);
+
+        // Loop over all atoms within this cell.
+        for (int n{cell_start(cell_index)}; n < cell_start(cell_index + 1);
+             ++n) {
+            int i{sorted_atom_indices(n)};
+            const bool active_i{all_active || active(i)};
+
+            for (size_t range{0}; range < ranges.size(); ++range) {
+                auto [begin, end]{ranges[range]};
+                // Within its own cell, the half shell only pairs an atom with
+                // the atoms that follow it.
+                if (half_shell && range == 0)
+                    begin = n + 1;
+                for (int m{begin}; m < end; ++m) {
+                    auto neighi{sorted_atom_indices(m)};
+
+                    // Exclude the atom from being its own neighbor. A half
+                    // list built from the full stencil only stores the pair
+                    // (i, j) with i < j.
+                    if (neighi == i || (is_half() && aliased && neighi < i))
+                        continue;
+
+                    // Skip pairs between ghosts that are not needed
+                    if (!active_i && !active(neighi))
+                        continue;
+
+                    auto distance_sq{
+                        distance_vector(r, i, neighi).squaredNorm()};
+
+                    if (distance_sq <= cutoffsq) {
+                        visit(i, neighi);
+                    }
+                }
+            }
+        }
+    };
+
+    // The search runs in two passes, such that it can be distributed over
+    // threads. The first pass searches for neighbors and counts them. Each
+    // thread appends the neighbors it finds to its own buffer and we record
+    // where the neighbors of each atom were put. Each atom sits in exactly one
+    // cell and is hence only touched by a single thread.
+    std::vector<std::vector<int>> thread_neighbors(max_threads());
+    Eigen::ArrayXi row_thread(atoms.nb_atoms()), row_start(atoms.nb_atoms()),
+        nb_neighbors_per_atom{Eigen::ArrayXi::Zero(atoms.nb_atoms())};
+#pragma omp parallel
+    {
+        int thread{thread_num()};
+        auto &buffer{thread_neighbors[thread]};
+        // The size of the previous list is a good guess for the new one.
+        buffer.reserve(neighbors_.size() / thread_neighbors.size());
+        std::vector<std::tuple<int, int>> ranges;
+        ranges.reserve(2 * stencil.size() + 27);
+#pragma omp for schedule(dynamic, 16)
+        for (int cell_index = 0; cell_index < nb_cells; ++cell_index) {
+            int start(buffer.size());
+            search_cell(cell_index, ranges, [&](int i, int j) {
+                buffer.push_back(j);
+                nb_neighbors_per_atom(i)++;
+            });
+
+            // The atoms of a cell are visited in order, hence their
+            // neighbors are stored consecutively.
+            for (int k{cell_start(cell_index)};
+                 k < cell_start(cell_index + 1); ++k) {
+                int i{sorted_atom_indices(k)};
+                row_thread(i) = thread;
+                row_start(i) = start;
+                start += nb_neighbors_per_atom(i);
+            }
+        }
+    }
 
-            // Skip if cell is out of bounds
-            if ((neigh_cell_coord < 0).any() ||
-                (neigh_cell_coord >= nb_grid_pts).any())
-                continue;
+    // The cumulative sum of the counts yields the position of the neighbors
+    // of each atom in the list, i.e. the neighbors of atom i are found
+    // between seed_(i) and seed_(i + 1).
+    seed_.resize(atoms.nb_atoms() + 1);
+    seed_(0) = 0;
+    std::partial_sum(nb_neighbors_per_atom.begin(), nb_neighbors_per_atom.end(),
+                     seed_.begin() + 1);
+
+    // The second pass copies the neighbors to their final position. The list
+    // is allocated once with its final size. Since the order in which the
+    // neighbors of an atom are visited is fixed, the result does not depend
+    // on the number of threads.
+    neighbors_.resize(seed_(atoms.nb_atoms()));
+#pragma omp parallel
+    {
+        std::vector<std::tuple<double, int>> row;
+#pragma omp for schedule(static)
+        for (int i = 0; i < atoms.nb_atoms(); ++i) {
+            std::copy_n(thread_neighbors[row_thread(i)].begin() + row_start(i),
+                        nb_neighbors_per_atom(i),
+                        neighbors_.begin() + seed_(i));
+
+            // Sort neighbors by distance, such that the neighbors within a
+            // smaller cutoff are at the beginning of each row
+            if (sort_by_distance_) {
+                row.clear();
+                for (int j : neighbors(i)) {
+                    row.push_back({distance_vector(r, i, j).squaredNorm(), j});
+                }
+                std::sort(row.begin(), row.end());
+                for (int n{0}; n < nb_neighbors_per_atom(i); ++n) {
+                    neighbors_(seed_(i) + n) = std::get<1>(row[n]);
+                }
+            }
+        }
+    }
 
-            int cell_index{coordinate_to_index(neigh_cell_coord, nb_grid_pts)};
+    return {seed_, neighbors_};
+}
 
-            // Find first entry within the cell neighbor list.
-            auto cell{std::lower_bound(binned_atoms.begin(), binned_atoms.end(),
-                                       cell_index,
-                                       [&](const auto &i, const auto &j) {
-                                           return std::get<0>(i) < j;
-                                       })};
+bool NeighborList::update_atoms(const Atoms &atoms,
+                                const Eigen::ArrayXi &indices, double cutoff) {
+    if (nb_local_ != reference_positions_.cols()) {
+        throw std::runtime_error("Incremental updates are not supported for "
+                                 "neighbor lists with ghost atoms.");
+    }
+    if (seed_.size() != atoms.nb_atoms() + 1 || cutoff != cutoff_) {
+        update(atoms, cutoff, domain_length_, periodicity_, skin_);
+        return true;
+    }
 
-            if (cell == binned_atoms.end() || std::get<0>(*cell) != cell_index)
+    // Atoms that are still within half of the skin of their reference
+    // position cannot have new neighbors within the cutoff.
+    std::vector<int> moved;
+    for (int m : indices) {
+        if (m < 0 || m >= atoms.nb_atoms()) {
+            throw std::runtime_error("Atom index out of range.");
+        }
+        if ((atoms.positions.col(m) - reference_positions_.col(m))
+                .square()
+                .sum() > skin_ * skin_ / 4) {
+            moved.push_back(m);
+        }
+    }
+    std::sort(moved.begin(), moved.end());
+    moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+    if (moved.empty())
+        return false;
+
+    // Pair geometry refers to the old neighbor array.
+    pair_distance_vectors_.resize(3, 0);
+    pair_distances_.resize(0);
+    pair_geometry_positions_.resize(3, 0);
+
+    // Cells are at least as wide as the interaction range, hence all
+    // neighbors of an atom are found in the 27 cells around its cell. In
+    // periodic directions the cells span the domain; otherwise the grid is
+    // unbounded and cell coordinates are folded into the 21 bits of the key.
+    // Folding can only add candidates, which are then rejected by distance.
+    const double range{cutoff_ + skin_};
+    const double range_sq{range * range};
+    Eigen::Array3i nb_cells{Eigen::Array3i::Zero()};
+    for (int dim{0}; dim < 3; ++dim) {
+        if (periodicity_(dim)) {
+            nb_cells(dim) =
+                static_cast<int>(std::floor(domain_length_(dim) / range));
+        }
+    }
+    auto cell_coordinates = [&](const Eigen::Array3d &position) {
+        Eigen::Array3i c;
+        for (int dim{0}; dim < 3; ++dim) {
+            if (periodicity_(dim)) {
+                double s{position(dim) / domain_length_(dim)};
+                s -= std::floor(s);
+                c(dim) = std::min(static_cast<int>(s * nb_cells(dim)),
+                                  nb_cells(dim) - 1);
+            } else {
+                c(dim) = static_cast<int>(std::floor(position(dim) / range));
+            }
+        }
+        return c;
+    };
+    auto cell_key = [&](Eigen::Array3i c) {
+        for (int dim{0}; dim < 3; ++dim) {
+            if (periodicity_(dim)) {
+                c(dim) = (c(dim) % nb_cells(dim) + nb_cells(dim)) % nb_cells(dim);
+            }
+        }
+        return pack_cell_coordinates(c(0) & (max_grid_pts - 1),
+                                     c(1) & (max_grid_pts - 1),
+                                     c(2) & (max_grid_pts - 1));
+    };
+
+    if (incremental_cell_of_atom_.size() !=
+        static_cast<size_t>(atoms.nb_atoms())) {
+        incremental_cells_.clear();
+        incremental_cell_of_atom_.resize(atoms.nb_atoms());
+        for (int i{0}; i < atoms.nb_atoms(); ++i) {
+            auto key{cell_key(cell_coordinates(reference_positions_.col(i)))};
+            incremental_cell_of_atom_[i] = key;
+            incremental_cells_[key].push_back(i);
+        }
+    }
+
+    // Return all atoms within the interaction range of atom m, using the
+    // reference positions. In a periodic direction with only two cells, the
+    // cells to the left and right are identical and must be visited once.
+    auto find_neighbors = [&](int m) {
+        Eigen::Array3i c{cell_coordinates(reference_positions_.col(m))};
+        std::vector<uint64_t> keys;
+        for (int dz{-1}; dz <= 1; ++dz) {
+            for (int dy{-1}; dy <= 1; ++dy) {
+                for (int dx{-1}; dx <= 1; ++dx) {
+                    keys.push_back(cell_key(c + Eigen::Array3i{dx, dy, dz}));
+                }
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::vector<int> found;
+        for (auto key : keys) {
+            auto cell{incremental_cells_.find(key)};
+            if (cell == incremental_cells_.end())
                 continue;
+            for (int j : cell->second) {
+                if (j != m &&
+                    distance_vector(reference_positions_, m, j)
+                            .squaredNorm() <= range_sq) {
+                    found.push_back(j);
+                }
+            }
+        }
+        return found;
+    };
+
+    // Rows that are patched, ordered by atom index
+    std::map<int, std::vector<int>> rows;
+    auto row = [&](int i) -> std::vector<int> & {
+        auto it{rows.find(i)};
+        if (it == rows.end()) {
+            auto neighbors_i{neighbors(i)};
+            it = rows.emplace(i, std::vector<int>(neighbors_i.begin(),
+                                                  neighbors_i.end()))
+                     .first;
+        }
+        return it->second;
+    };
+
+    // Moved atoms are processed one after the other, such that each step
+    // moves a single atom with respect to a consistent list. All pairs of the
+    // moved atom are removed and then stored again. (A half list may store a
+    // pair in the row of either atom; we store it in the row of the moved
+    // atom.)
+    for (int m : moved) {
+        std::vector<int> old_neighbors{find_neighbors(m)};
+        for (int j : row(m)) {
+            old_neighbors.push_back(j);
+        }
+        for (int j : old_neighbors) {
+            auto &row_j{row(j)};
+            row_j.erase(std::remove(row_j.begin(), row_j.end(), m), row_j.end());
+        }
 
-            for (int j{std::get<1>(*cell)};
-                 j < atom_to_cell.size() &&
-                 atom_to_cell(sorted_atom_indices(j)) == cell_index;
-                 ++j) {
-                auto neighi{sorted_atom_indices(j)};
+        auto &cell{incremental_cells_[incremental_cell_of_atom_[m]]};
+        cell.erase(std::find(cell.begin(), cell.end(), m));
+        reference_positions_.col(m) = atoms.positions.col(m);
+        incremental_cell_of_atom_[m] =
+            cell_key(cell_coordinates(reference_positions_.col(m)));
+        incremental_cells_[incremental_cell_of_atom_[m]].push_back(m);
+
+        auto new_neighbors{find_neighbors(m)};
+        if (!is_half()) {
+            for (int j : new_neighbors) {
+                row(j).push_back(m);
+            }
+        }
+        row(m) = std::move(new_neighbors);
+    }
 
-                // Exclude the atom from being its own neighbor
-                if (neighi == i)
-                    continue;
+    if (sort_by_distance_) {
+        for (auto &[i, row_i] : rows) {
+            std::sort(row_i.begin(), row_i.end(), [&, i = i](int j1, int j2) {
+                return distance_vector(reference_positions_, i, j1)
+                           .squaredNorm() <
+                       distance_vector(reference_positions_, i, j2)
+                           .squaredNorm();
+            });
+        }
+    }
 
-                auto distance_sq =
-                    (r.col(i) - r.col(neighi)).matrix().squaredNorm();
+    // Write the patched rows back. If no row changed its length, this is
+    // done in place. Otherwise the unchanged rows are copied in blocks and
+    // their seeds are shifted; this copy of the whole list dominates the cost
+    // of the update for large systems.
+    bool same_lengths{true};
+    int nb_entries{nb_neighbors()};
+    for (auto &[i, row_i] : rows) {
+        same_lengths = same_lengths && static_cast<int>(row_i.size()) ==
+                                           nb_neighbors(i);
+        nb_entries += static_cast<int>(row_i.size()) - nb_neighbors(i);
+    }
+    if (same_lengths) {
+        for (auto &[i, row_i] : rows) {
+            std::copy(row_i.begin(), row_i.end(), neighbors_.data() + seed_(i));
+        }
+        return true;
+    }
 
-                if (distance_sq <= cutoffsq) {
-                    if (n >= neighbors_.size()) {
-                        neighbors_.conservativeResize(std::max(1L, 2 * neighbors_.size()));
-                    }
-                    neighbors_(n) = neighi;
-                    n++;
-                }
-            }
+    Eigen::ArrayXi seed(seed_.size()), neighbors(nb_entries);
+    int n{0}, first_unchanged{0};
+    auto copy_unchanged = [&](int end) {
+        const int begin{seed_(first_unchanged)};
+        seed.segment(first_unchanged, end - first_unchanged) =
+            seed_.segment(first_unchanged, end - first_unchanged) + (n - begin);
+        std::copy(neighbors_.data() + begin, neighbors_.data() + seed_(end),
+                  neighbors.data() + n);
+        n += seed_(end) - begin;
+    };
+    for (auto &[i, row_i] : rows) {
+        copy_unchanged(i);
+        seed(i) = n;
+        std::copy(row_i.begin(), row_i.end(), neighbors.data() + n);
+        n += static_cast<int>(row_i.size());
+        first_unchanged = i + 1;
+    }
+    copy_unchanged(atoms.nb_atoms());
+    seed(atoms.nb_atoms()) = n;
+    seed_.swap(seed);
+    neighbors_.swap(neighbors);
+    return true;
+}
+
+void NeighborList::update_pair_geometry(const Positions_t &positions) {
+    if (seed_.size() == 0) {
+        throw std::runtime_error("Neighbor list not yet computed. Use "
+                                 "`update` to compute it.");
+    }
+
+    const int nb_rows{static_cast<int>(seed_.size()) - 1};
+    pair_distance_vectors_.resize(3, nb_neighbors());
+    pair_distances_.resize(nb_neighbors());
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < nb_rows; ++i) {
+        Eigen::Array3d position_i{positions.col(i)};
+        for (int n{seed_(i)}; n < seed_(i + 1); ++n) {
+            Eigen::Array3d distance_vector{
+                minimum_image(position_i - positions.col(neighbors_(n)))};
+            pair_distance_vectors_.col(n) = distance_vector;
+            pair_distances_(n) = std::sqrt(distance_vector.square().sum());
         }
     }
-    seed_(atoms.nb_atoms()) = n;
-    neighbors_.conservativeResize(n);
+    pair_geometry_positions_ = positions;
+}
 
-    return {seed_, neighbors_};
+NeighborListView NeighborList::view(double cutoff) const {
+    if (!sort_by_distance_) {
+        throw std::runtime_error("Views require a neighbor list that is "
+                                 "sorted by distance.");
+    }
+    if (cutoff > cutoff_) {
+        throw std::runtime_error("Cutoff of view exceeds cutoff of the "
+                                 "neighbor list.");
+    }
+
+    // The neighbors within the smaller cutoff (plus the skin) at the time the
+    // list was built are the first entries of each row.
+    const double cutoff_sq{(cutoff + skin_) * (cutoff + skin_)};
+    const int nb_rows{static_cast<int>(seed_.size()) - 1};
+    Eigen::ArrayXi row_end(nb_rows);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < nb_rows; ++i) {
+        row_end(i) = std::partition_point(
+            neighbors_.begin() + seed_(i), neighbors_.begin() + seed_(i + 1),
+            [&](int j) {
+                return distance_vector(reference_positions_, i, j)
+                           .squaredNorm() <= cutoff_sq;
+            }) - neighbors_.begin();
+    }
+    return NeighborListView{*this, row_end};
 }
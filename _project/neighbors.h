@@ -25,17 +25,180 @@
 #ifndef YAMD_NEIGHBORS_H
 #define YAMD_NEIGHBORS_H
 
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
 #include "atoms.h"
 
+class NeighborListView;
+
 class NeighborList {
   public:
-    NeighborList();
+    /*
+     * Storage mode of the neighbor list. A full list stores each pair twice,
+     * as (i, j) and as (j, i). A half list stores each pair only once, either
+     * as (i, j) or as (j, i).
+     */
+    enum class Storage { full, half };
+
+    /*
+     * The search bins atoms into cells that are `cutoff / bins_per_cutoff`
+     * wide. Smaller cells fit the cutoff sphere more tightly and reduce the
+     * number of distance checks, but there are more cells to visit. Two bins
+     * per cutoff are fastest for dense metals. If `sort_by_distance` is true,
+     * the neighbors of each atom are sorted by distance, which allows to
+     * obtain views for smaller cutoffs (see `view`).
+     */
+    explicit NeighborList(Storage storage = Storage::full, int bins_per_cutoff = 2, bool sort_by_distance = false);
+
+    /*
+     * Return true if this is a half list, i.e. each pair is stored once
+     */
+    bool is_half() const { return storage_ == Storage::half; }
+
+    /*
+     * Return true if the neighbor `j` in the row of atom `i` is the entry
+     * that `for_each_pair` visits for this pair. A half list contains each
+     * pair once; a full list contains it twice and its entry with j < i is
+     * skipped. Kernels that loop over rows use this to visit each pair once.
+     */
+    bool is_pair_entry(int i, int j) const { return is_half() || j > i; }
 
     /*
      * Update neighbor list from the particle positons stores in the `atoms`
-     * argument
+     * argument. All pairs within a distance of `cutoff + skin` are stored.
+     */
+    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &> update(const Atoms &atoms, double cutoff,
+                                                                            double skin = 0.0);
+
+    /*
+     * Update neighbor list for a domain that is periodic in the directions for
+     * which `periodicity` is nonzero. In these directions the domain spans the
+     * interval [0, domain_length) and the minimum image convention is used,
+     * which requires the domain to be at least twice as long as
+     * `cutoff + skin`. Atoms do not need to be wrapped into the domain. Use
+     * `distance_vector` to compute distances between neighbors.
+     */
+    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+    update(const Atoms &atoms, double cutoff, const Eigen::Array3d &domain_length, const Eigen::Array3i &periodicity,
+           double skin = 0.0);
+
+    /*
+     * Update neighbor list of a process-local set of atoms under domain
+     * decomposition. The first `nb_local` atoms are local, the remaining ones
+     * are ghosts. Only the rows of local atoms and of the ghosts that are
+     * within `nb_ghost_shells` neighbor shells of a local atom are complete;
+     * pairs between two other ghosts are skipped. A pair potential only needs
+     * the neighbors of the local atoms (zero shells). An EAM potential also
+     * needs the density on the ghosts that are neighbors of local atoms (one
+     * shell).
+     */
+    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+    update(const Atoms &atoms, double cutoff, double skin, int nb_local, int nb_ghost_shells = 1);
+
+    /*
+     * Update the neighbor list only if it is stale. The list is built with an
+     * interaction range of `cutoff + skin` and is rebuilt once an atom has
+     * moved by more than `skin / 2` since the last build. Returns true if the
+     * list was rebuilt.
+     */
+    bool update_if_needed(const Atoms &atoms, double cutoff, double skin);
+
+    /*
+     * Update the neighbor list of a periodic domain only if it is stale
+     */
+    bool update_if_needed(const Atoms &atoms, double cutoff, double skin, const Eigen::Array3d &domain_length,
+                          const Eigen::Array3i &periodicity);
+
+    /*
+     * Update the neighbor list after only the atoms in `indices` have moved,
+     * e.g. for Monte Carlo trial moves, local relaxations or finite-difference
+     * checks. Moved atoms that are still within half of the skin distance of
+     * their position at the last build are ignored. The others are re-binned
+     * and only the rows of these atoms and of their old and new neighbors are
+     * recomputed, which costs O(neighbors) distance computations instead of
+     * O(N). The patched rows are written back in place if none of them
+     * changed its length. Otherwise the list is stored contiguously and is
+     * copied once, which is O(N) memory traffic (but no distance
+     * computations) per call. The list is rebuilt from scratch if the cutoff
+     * or the number of atoms changed. Lists that contain ghost atoms cannot be
+     * patched. Returns true if the list was modified.
      */
-    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &> update(const Atoms &atoms, double cutoff);
+    bool update_atoms(const Atoms &atoms, const Eigen::ArrayXi &indices, double cutoff);
+
+    /*
+     * Return true if the neighbor list needs to be rebuilt, i.e. if it has
+     * never been built, if cutoff, skin, domain or number of atoms changed, or
+     * if some atom has moved by more than half of the skin distance.
+     */
+    bool needs_update(const Atoms &atoms, double cutoff, double skin) const;
+
+    bool needs_update(const Atoms &atoms, double cutoff, double skin, const Eigen::Array3d &domain_length,
+                      const Eigen::Array3i &periodicity) const;
+
+    /*
+     * Return a view of this list that only contains the neighbors within
+     * `cutoff` (plus the skin distance). This requires a list that is sorted
+     * by distance and that was built with a cutoff of at least `cutoff`.
+     * Building the view does not search for neighbors, hence a single list
+     * built with the largest cutoff can serve several potentials and
+     * analyses. The view is valid until the list is updated.
+     */
+    NeighborListView view(double cutoff) const;
+
+    /*
+     * Compute and store the distance vectors r_i - r_j and the distances of
+     * all entries of the list for the given positions. The buffers are
+     * aligned with the neighbor array, i.e. `pair_distances(i)(k)` is the
+     * distance between atom `i` and `neighbors(i)(k)`. Potentials with
+     * several passes over the pairs can then read the geometry instead of
+     * recomputing it. The buffers need 32 bytes per entry of the list and are
+     * discarded when the list is rebuilt.
+     */
+    void update_pair_geometry(const Positions_t &positions);
+
+    /*
+     * Return true if the stored pair geometry was computed for exactly these
+     * positions. This compares the positions and is O(N).
+     */
+    bool has_pair_geometry(const Positions_t &positions) const {
+        return pair_distances_.size() > 0 && pair_geometry_positions_.cols() == positions.cols() &&
+               (pair_geometry_positions_ == positions).all();
+    }
+
+    /*
+     * Return the distance vectors and distances of the neighbors of atom `i`
+     * computed by the last call to `update_pair_geometry`
+     */
+    auto pair_distance_vectors(int i) const {
+        assert(pair_distances_.size() > 0);
+        return pair_distance_vectors_.middleCols(seed_(i), seed_(i + 1) - seed_(i));
+    }
+
+    auto pair_distances(int i) const {
+        assert(pair_distances_.size() > 0);
+        return pair_distances_.segment(seed_(i), seed_(i + 1) - seed_(i));
+    }
+
+    /*
+     * Return the distance vector r_i - r_j between atoms `i` and `j`. In
+     * periodic directions this is the minimum image.
+     */
+    Eigen::Vector3d distance_vector(const Positions_t &positions, int i, int j) const {
+        return minimum_image(positions.col(i) - positions.col(j));
+    }
+
+    /*
+     * Map a distance vector onto its minimum image. This does nothing if the
+     * list is not periodic.
+     */
+    Eigen::Array3d minimum_image(const Eigen::Array3d &distance_vector) const {
+        if (is_periodic_) {
+            return distance_vector - periodic_length_ * (distance_vector * inverse_periodic_length_).round();
+        }
+        return distance_vector;
+    }
 
     /*
      * Return internal seed and neighbor arrays
@@ -59,7 +222,8 @@ class NeighborList {
 
     /*
      * Return the number of neighbors of atom `i` found by the last call to
-     * `update`
+     * `update`. For a half list, every neighbor shows up only in one of the
+     * two rows.
      */
     int nb_neighbors(int i) const {
         assert(i >= 0);
@@ -67,6 +231,49 @@ class NeighborList {
         return seed_(i + 1) - seed_(i);
     }
 
+    /*
+     * Return the neighbors of atom `i` as a contiguous view into the internal
+     * neighbor array. Use as
+     *     for (int j : neighbor_list.neighbors(i)) { ... }
+     * This is the fastest way to loop over neighbors, since any work that
+     * only depends on `i` can be done outside of the loop over `j`.
+     */
+    auto neighbors(int i) const {
+        assert(i >= 0);
+        assert(i < seed_.size() - 1);
+        return neighbors_.segment(seed_(i), seed_(i + 1) - seed_(i));
+    }
+
+    /*
+     * Call `kernel(i, j)` for every neighbor `j` of every atom `i`. For a full
+     * list this visits each pair twice.
+     */
+    template <typename Kernel>
+    void for_each_neighbor(Kernel &&kernel) const {
+        for (int i{0}; i < seed_.size() - 1; ++i) {
+            for (int j : neighbors(i)) {
+                kernel(i, j);
+            }
+        }
+    }
+
+    /*
+     * Call `kernel(i, j)` exactly once for every pair of neighbors,
+     * irrespective of whether the list is a half or a full list. This is
+     * equivalent to iterating over `pairs()`, but the kernel is inlined into
+     * a plain loop over the neighbor array.
+     */
+    template <typename Kernel>
+    void for_each_pair(Kernel &&kernel) const {
+        for (int i{0}; i < seed_.size() - 1; ++i) {
+            for (int j : neighbors(i)) {
+                if (is_pair_entry(i, j)) {
+                    kernel(i, j);
+                }
+            }
+        }
+    }
+
     class iterator {
         // Defining types to be used in std::iterator_traits
         // see https://en.cppreference.com/w/cpp/iterator/iterator_traits
@@ -77,16 +284,17 @@ class NeighborList {
         using iterator_category = std::input_iterator_tag;
 
       public:
-        explicit iterator(const Eigen::ArrayXi &seed, const Eigen::ArrayXi &neighbors, int i, int n)
-            : seed_{seed}, neighbors_{neighbors}, i_{i}, n_{n} {}
+        explicit iterator(const Eigen::ArrayXi &seed, const Eigen::ArrayXi &neighbors, int i, int n,
+                          bool unique = false)
+            : seed_{seed}, neighbors_{neighbors}, i_{i}, n_{n}, unique_{unique} {
+            skip();
+        }
 
         iterator &operator++() {
             assert(n_ < seed_(seed_.size() - 1));
 
             n_++;
-            while (n_ == seed_(i_ + 1) && i_ < seed_.size() - 2) {
-                i_++;
-            }
+            skip();
             return *this;
         }
 
@@ -97,41 +305,91 @@ class NeighborList {
         reference operator*() const { return {i_, neighbors_(n_)}; }
 
       protected:
+        // Fast-forward to the next entry that should be visited. This skips
+        // atoms that have no (further) neighbors and, if we only want to see
+        // each pair once, the (j, i) entries of a full list.
+        void skip() {
+            while (n_ < seed_(seed_.size() - 1)) {
+                if (n_ == seed_(i_ + 1)) {
+                    i_++;
+                } else if (unique_ && neighbors_(n_) < i_) {
+                    n_++;
+                } else {
+                    break;
+                }
+            }
+        }
+
         const Eigen::ArrayXi &seed_;
         const Eigen::ArrayXi &neighbors_;
         int i_, n_;
+        bool unique_;
     };
 
     /*
      * Return iterator that represents the beginning of the neighbor list
      */
-    iterator begin() const {
+    iterator begin() const { return begin(false); }
+
+    /*
+     * Return iterator that represents the end of the neighbor list
+     */
+    iterator end() const {
         if (seed_.size() > 0) {
-            int i0{0}, n0{seed_(0)};
-            assert(n0 == 0);  // seed_(0) should be zero
-            // If the first atom has no neighbors, we need to fast-forward the
-            // counter to the first atom that does have a neighbor.
-            while (n0 == seed_(i0 + 1) && n0 < nb_neighbors()) {
-                i0++;
-            }
-            return iterator(seed_, neighbors_, i0, n0);
+            return iterator(seed_, neighbors_, seed_.size() - 2, nb_neighbors());
         } else {
             throw std::runtime_error("Neighbor list not yet computed. Use `update` to compute it.");
         }
     }
 
     /*
-     * Return iterator that represents the end of the neighbor list
+     * Range that visits each pair of neighbors exactly once, irrespective of
+     * whether the list is a half or a full list
      */
-    iterator end() const {
+    class pair_range {
+      public:
+        explicit pair_range(const NeighborList &neighbor_list) : neighbor_list_{neighbor_list} {}
+
+        iterator begin() const { return neighbor_list_.begin(!neighbor_list_.is_half()); }
+
+        iterator end() const { return neighbor_list_.end(); }
+
+      protected:
+        const NeighborList &neighbor_list_;
+    };
+
+    /*
+     * Return a range over unique pairs. Use as
+     *     for (auto [i, j] : neighbor_list.pairs()) { ... }
+     * For a half list, this is identical to iterating over the list itself.
+     * For a full list, the (j, i) entries are skipped.
+     */
+    pair_range pairs() const { return pair_range{*this}; }
+
+  protected:
+    // Compresses the neighbor indices and releases the uncompressed ones
+    friend class CompressedNeighborList;
+
+    /*
+     * Build the neighbor list; all atoms starting at `nb_local` are ghosts
+     */
+    const std::tuple<const Eigen::ArrayXi &, const Eigen::ArrayXi &>
+    _update(const Atoms &atoms, double cutoff, const Eigen::Array3d &domain_length, const Eigen::Array3i &periodicity,
+            double skin, int nb_local, int nb_ghost_shells);
+
+    /*
+     * Return iterator to the first entry; skip (j, i) entries if `unique` is
+     * true
+     */
+    iterator begin(bool unique) const {
         if (seed_.size() > 0) {
-            return iterator(seed_, neighbors_, seed_.size() - 2, nb_neighbors());
+            assert(seed_(0) == 0);  // seed_(0) should be zero
+            return iterator(seed_, neighbors_, 0, seed_(0), unique);
         } else {
             throw std::runtime_error("Neighbor list not yet computed. Use `update` to compute it.");
         }
     }
 
-  protected:
     template <typename T>
     static decltype(auto) coordinate_to_index(const T &x, const T &y, const T &z, const Eigen::Array3i &nb_grid_pts) {
         return x + nb_grid_pts(0) * (y + nb_grid_pts(1) * z);
@@ -146,8 +404,102 @@ class NeighborList {
         return coordinate_to_index(c.row(0), c.row(1), c.row(2), nb_grid_pts);
     }
 
+    // Full or half list
+    Storage storage_;
+
+    // Number of cells per cutoff distance
+    int bins_per_cutoff_;
+
+    // Sort the neighbors of each atom by distance
+    bool sort_by_distance_;
+
     Eigen::ArrayXi seed_;
     Eigen::ArrayXi neighbors_;
+
+    // Cutoff and skin distance used in the last call to `update`
+    double cutoff_, skin_;
+
+    // Domain used in the last call to `update`. The periodic length is the
+    // domain length in periodic directions and zero otherwise.
+    Eigen::Array3d domain_length_;
+    Eigen::Array3i periodicity_;
+    bool is_periodic_;
+    Eigen::Array3d periodic_length_, inverse_periodic_length_;
+
+    // Atoms starting at `nb_local_` were ghosts in the last call to `update`
+    int nb_local_;
+
+    // Positions at the time of the last call to `update`; used to determine
+    // whether the list is still valid
+    Positions_t reference_positions_;
+
+    // Distance vectors and distances of all entries of the neighbor array,
+    // and the positions they were computed for
+    Eigen::Array3Xd pair_distance_vectors_;
+    Eigen::ArrayXd pair_distances_;
+    Positions_t pair_geometry_positions_;
+
+    // Atoms binned by their reference positions into cells that are at least
+    // `cutoff + skin` wide, and the cell of each atom. This grid is built on
+    // the first call to `update_atoms` after a full update.
+    std::unordered_map<uint64_t, std::vector<int>> incremental_cells_;
+    std::vector<uint64_t> incremental_cell_of_atom_;
+};
+
+/*
+ * Neighbors of a `NeighborList` within a smaller cutoff. The neighbors of
+ * atom i are the first entries of the i-th row of the underlying list.
+ */
+class NeighborListView {
+  public:
+    NeighborListView(const NeighborList &neighbor_list, const Eigen::ArrayXi &row_end)
+        : neighbor_list_{neighbor_list}, seed_{std::get<0>(neighbor_list.neighbors())},
+          neighbors_{std::get<1>(neighbor_list.neighbors())}, row_end_{row_end} {}
+
+    bool is_half() const { return neighbor_list_.is_half(); }
+
+    bool is_pair_entry(int i, int j) const { return neighbor_list_.is_pair_entry(i, j); }
+
+    Eigen::Array3d minimum_image(const Eigen::Array3d &distance_vector) const {
+        return neighbor_list_.minimum_image(distance_vector);
+    }
+
+    Eigen::Vector3d distance_vector(const Positions_t &positions, int i, int j) const {
+        return neighbor_list_.distance_vector(positions, i, j);
+    }
+
+    /*
+     * Return the neighbors of atom `i` within the cutoff of the view
+     */
+    auto neighbors(int i) const { return neighbors_.segment(seed_(i), row_end_(i) - seed_(i)); }
+
+    /*
+     * Return the number of neighbors of atom `i` within the cutoff
+     */
+    int nb_neighbors(int i) const { return neighbors(i).size(); }
+
+    /*
+     * Call `kernel(i, j)` exactly once for every pair of neighbors, see
+     * `NeighborList::for_each_pair`
+     */
+    template <typename Kernel>
+    void for_each_pair(Kernel &&kernel) const {
+        for (int i{0}; i < row_end_.size(); ++i) {
+            for (int j : neighbors(i)) {
+                if (is_pair_entry(i, j)) {
+                    kernel(i, j);
+                }
+            }
+        }
+    }
+
+  protected:
+    const NeighborList &neighbor_list_;
+    const Eigen::ArrayXi &seed_;
+    const Eigen::ArrayXi &neighbors_;
+
+    // Neighbors of atom i are stored between seed_(i) and row_end_(i)
+    Eigen::ArrayXi row_end_;
 };
 
 #endif  // YAMD_NEIGHBORS_H
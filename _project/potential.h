@@ -0,0 +1,232 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_POTENTIAL_H
+#define YAMD_POTENTIAL_H
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+#include "atoms.h"
+#include "neighbors.h"
+#include "virial.h"
+
+/*
+ * Base class of potentials that are evaluated on a neighbor list. A potential
+ * `Derived` inherits from `Potential<Derived>` and implements some of the
+ * following phases, which `compute` calls in this order:
+ *     void reset(const Atoms &atoms)
+ *         Prepare per-atom state for a new evaluation.
+ *     void accumulate_density(int i, int j, double distance)
+ *         Called once for every pair within `cutoff()`, if `has_density` is
+ *         true. Embedded atom potentials accumulate densities here.
+ *     void finalize_density(Atoms &atoms)
+ *         Add the embedding energies to `atoms.energies`.
+ *     double accumulate(int i, int j, double distance, double &d_energy)
+ *         Called once for every pair within `cutoff()`, in the same order as
+ *         `accumulate_density`. Returns the energy of the pair and adds its
+ *         derivative with respect to the distance to `d_energy`. This
+ *         includes the embedding energy that depends on the distance.
+ *     void finalize(Atoms &atoms)
+ *         Add energies and forces that do not stem from pairs, such as those
+ *         of an external wall.
+ * The base class provides empty phases, a cutoff of zero and no density.
+ * All calls are resolved at compile time and inlined into the pair loops.
+ */
+template <typename Derived>
+class Potential {
+  public:
+    static constexpr bool has_density{false};
+
+    double cutoff() const { return 0; }
+
+    void reset(const Atoms &) {}
+
+    void accumulate_density(int, int, double) {}
+
+    void finalize_density(Atoms &) {}
+
+    double accumulate(int, int, double, double &) { return 0; }
+
+    void finalize(Atoms &) {}
+
+    /*
+     * Compute energies and forces. Forces and per-atom energies are reset
+     * once and then accumulated by all phases. The neighbor list can be a full
+     * or a half list and may be periodic. Returns the total potential energy.
+     */
+    double compute(Atoms &atoms, const NeighborList &neighbor_list) {
+        return _compute(atoms, neighbor_list, nullptr);
+    }
+
+    /*
+     * Compute energies, forces and the virial (see `Virial`) of the pairs
+     */
+    double compute(Atoms &atoms, const NeighborList &neighbor_list,
+                   Virial &virial) {
+        return _compute(atoms, neighbor_list, &virial);
+    }
+
+  protected:
+    double _compute(Atoms &atoms, const NeighborList &neighbor_list,
+                    Virial *virial) {
+        auto &potential{static_cast<Derived &>(*this)};
+        const double cutoff{potential.cutoff()};
+        const double cutoff_sq{cutoff * cutoff};
+
+        atoms.forces.setZero();
+        atoms.energies.setZero();
+        potential.reset(atoms);
+
+        if (virial)
+            virial->reset(atoms.nb_atoms());
+
+        auto &&positions{atoms.positions};
+        auto for_each_pair_within_cutoff = [&](auto &&kernel) {
+            neighbor_list.for_each_pair([&](int i, int j) {
+                Eigen::Array3d distance_vector{neighbor_list.minimum_image(
+                    positions.col(i) - positions.col(j))};
+                const double distance_sq{distance_vector.square().sum()};
+                if (distance_sq < cutoff_sq)
+                    kernel(i, j, distance_vector, std::sqrt(distance_sq));
+            });
+        };
+
+        if constexpr (Derived::has_density) {
+            for_each_pair_within_cutoff(
+                [&](int i, int j, const Eigen::Array3d &, double distance) {
+                    potential.accumulate_density(i, j, distance);
+                });
+            potential.finalize_density(atoms);
+        }
+
+        for_each_pair_within_cutoff([&](int i, int j,
+                                        const Eigen::Array3d &distance_vector,
+                                        double distance) {
+            double d_energy{0};
+            const double energy{potential.accumulate(i, j, distance, d_energy)};
+
+            // pair energy, split evenly between both atoms
+            atoms.energies(i) += 0.5 * energy;
+            atoms.energies(j) += 0.5 * energy;
+
+            Eigen::Array3d pair_force{d_energy / distance * distance_vector};
+            atoms.forces.col(i) -= pair_force;
+            atoms.forces.col(j) += pair_force;
+
+            if (virial)
+                virial->add_pair(i, j, distance_vector, pair_force);
+        });
+
+        potential.finalize(atoms);
+
+        return atoms.energies.sum();
+    }
+};
+
+/*
+ * Sum of several potentials that are evaluated in one pass over a single
+ * neighbor list, e.g.
+ *     PotentialSum potential{Ducastelle(cutoff), LennardJonesWall(...)};
+ *     double energy{potential.compute(atoms, neighbor_list)};
+ * The cutoff of the sum is the largest cutoff of its terms; each term only
+ * sees the pairs within its own cutoff.
+ */
+template <typename... Terms>
+class PotentialSum : public Potential<PotentialSum<Terms...>> {
+  public:
+    static constexpr bool has_density{(Terms::has_density || ...)};
+
+    explicit PotentialSum(const Terms &...terms) : terms_{terms...} {}
+
+    /*
+     * Return the I-th term
+     */
+    template <int I>
+    auto &term() {
+        return std::get<I>(terms_);
+    }
+
+    double cutoff() const {
+        return std::apply(
+            [](auto &...terms) { return std::max({0.0, terms.cutoff()...}); },
+            terms_);
+    }
+
+    void reset(const Atoms &atoms) {
+        std::apply([&](auto &...terms) { (terms.reset(atoms), ...); }, terms_);
+    }
+
+    void accumulate_density(int i, int j, double distance) {
+        std::apply(
+            [&](auto &...terms) {
+                (_accumulate_density(terms, i, j, distance), ...);
+            },
+            terms_);
+    }
+
+    void finalize_density(Atoms &atoms) {
+        std::apply(
+            [&](auto &...terms) { (terms.finalize_density(atoms), ...); },
+            terms_);
+    }
+
+    double accumulate(int i, int j, double distance, double &d_energy) {
+        double energy{0};
+        std::apply(
+            [&](auto &...terms) {
+                ((energy += _accumulate(terms, i, j, distance, d_energy)), ...);
+            },
+            terms_);
+        return energy;
+    }
+
+    void finalize(Atoms &atoms) {
+        std::apply([&](auto &...terms) { (terms.finalize(atoms), ...); },
+                   terms_);
+    }
+
+  protected:
+    // Forward a pair to a term if it is within the cutoff of that term
+    template <typename Term>
+    static void _accumulate_density(Term &term, int i, int j, double distance) {
+        if constexpr (Term::has_density) {
+            if (distance < term.cutoff())
+                term.accumulate_density(i, j, distance);
+        }
+    }
+
+    template <typename Term>
+    static double _accumulate(Term &term, int i, int j, double distance,
+                              double &d_energy) {
+        return distance < term.cutoff()
+                   ? term.accumulate(i, j, distance, d_energy)
+                   : 0;
+    }
+
+    std::tuple<Terms...> terms_;
+};
+
+#endif  // YAMD_POTENTIAL_H
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+
+#include "spatial_sort.h"
+
+// Spread the lower 21 bits of x such that there are two zero bits between
+// any two bits of the input
+static uint64_t spread_bits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+Eigen::ArrayXi morton_order(const Positions_t &positions, double cell_size) {
+    if (cell_size <= 0) {
+        throw std::runtime_error("Cell size for spatial sorting must be positive.");
+    }
+
+    const Eigen::Index nb_atoms{positions.cols()};
+    Eigen::ArrayXi permutation(Eigen::ArrayXi::LinSpaced(nb_atoms, 0, nb_atoms - 1));
+    if (nb_atoms == 0) {
+        return permutation;
+    }
+
+    // Integer cell coordinates relative to the lower corner of the bounding
+    // box; 21 bits per dimension fit into a 64-bit key
+    Eigen::Array3d origin{positions.rowwise().minCoeff()};
+    Eigen::Array3Xi cell_coords{((positions.colwise() - origin) / cell_size).floor().cast<int>().min(0x1fffff)};
+
+    std::vector<uint64_t> keys(nb_atoms);
+    for (Eigen::Index i{0}; i < nb_atoms; ++i) {
+        keys[i] = spread_bits(cell_coords(0, i)) | spread_bits(cell_coords(1, i)) << 1 |
+                  spread_bits(cell_coords(2, i)) << 2;
+    }
+
+    std::stable_sort(permutation.begin(), permutation.end(), [&keys](int i, int j) { return keys[i] < keys[j]; });
+
+    return permutation;
+}
+
+void reorder_atoms(Atoms &atoms, const Eigen::ArrayXi &permutation) {
+    if (permutation.size() != atoms.nb_atoms()) {
+        throw std::runtime_error("Permutation does not match number of atoms.");
+    }
+    if (atoms.types.size() != atoms.nb_atoms()) {
+        throw std::runtime_error("Expected one type per atom.");
+    }
+
+    Names_t names(permutation.size());
+    for (Eigen::Index i{0}; i < permutation.size(); ++i) {
+        names[i] = std::move(atoms.names[permutation(i)]);
+    }
+    atoms.names = std::move(names);
+
+    atoms.masses = atoms.masses(permutation).eval();
+    atoms.types = atoms.types(permutation).eval();
+    atoms.positions = atoms.positions(Eigen::all, permutation).eval();
+    atoms.velocities = atoms.velocities(Eigen::all, permutation).eval();
+    atoms.forces = atoms.forces(Eigen::all, permutation).eval();
+    atoms.energies = atoms.energies(permutation).eval();
+}
+
+Eigen::ArrayXi sort_atoms(Atoms &atoms, double cell_size) {
+    Eigen::ArrayXi permutation{morton_order(atoms.positions, cell_size)};
+    reorder_atoms(atoms, permutation);
+    return permutation;
+}
+
+Eigen::ArrayXi inverse_permutation(const Eigen::ArrayXi &permutation) {
+    Eigen::ArrayXi inverse(permutation.size());
+    inverse(permutation) = Eigen::ArrayXi::LinSpaced(permutation.size(), 0, permutation.size() - 1);
+    return inverse;
+}
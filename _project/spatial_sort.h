@@ -0,0 +1,70 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_SPATIAL_SORT_H
+#define YAMD_SPATIAL_SORT_H
+
+#include <Eigen/Dense>
+
+#include "atoms.h"
+
+/*
+ * Compute the order of the atoms along a Morton (Z-order) space-filling curve
+ * through a grid of cubic cells with edge length `cell_size`. Atoms that are
+ * close in space end up close in memory, which makes the accesses of the
+ * neighbor search and of the potentials cache friendly. A good choice for
+ * `cell_size` is the cutoff of the neighbor list. Atoms within the same cell
+ * keep their relative order. The returned permutation holds the old index of
+ * every atom, i.e. atom `i` in the sorted order is atom `permutation(i)` in
+ * the original order.
+ */
+Eigen::ArrayXi morton_order(const Positions_t &positions, double cell_size);
+
+/*
+ * Reorder the names, masses, types, positions, velocities, forces and
+ * energies of all atoms: After the call, atom `i` is the atom that was stored
+ * at index `permutation(i)` before the call.
+ */
+void reorder_atoms(Atoms &atoms, const Eigen::ArrayXi &permutation);
+
+/*
+ * Sort the atoms along a Morton curve (see `morton_order`) and return the
+ * permutation that has been applied. Sorting moves atoms, hence the neighbor
+ * list needs to be rebuilt afterwards; the natural place for sorting is
+ * therefore right before a neighbor list rebuild. To be able to write atoms
+ * in their original order, keep track of the original index of each atom,
+ *     Eigen::ArrayXi original_index = Eigen::ArrayXi::LinSpaced(n, 0, n - 1);
+ *     ...
+ *     original_index = original_index(sort_atoms(atoms, cutoff)).eval();
+ * and restore the original order with
+ *     reorder_atoms(atoms, inverse_permutation(original_index));
+ */
+Eigen::ArrayXi sort_atoms(Atoms &atoms, double cell_size);
+
+/*
+ * Return the inverse of a permutation.
+ */
+Eigen::ArrayXi inverse_permutation(const Eigen::ArrayXi &permutation);
+
+#endif // YAMD_SPATIAL_SORT_H
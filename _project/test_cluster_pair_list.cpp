@@ -0,0 +1,96 @@
+/*
+* Copyright 2021 Lars Pastewka
+*
+* ### MIT license
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <algorithm>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "atoms.h"
+#include "cluster_pair_list.h"
+#include "neighbors.h"
+#include "xyz.h"
+
+TEST(ClusterPairListTest, ContainsAllPairs) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms(names, positions);
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+
+    ClusterPairList<4> cluster_pair_list;
+    cluster_pair_list.update(atoms, cutoff);
+
+    // Every atom is in exactly one cluster, the remaining slots are padding
+    const int nb_clusters{cluster_pair_list.nb_clusters()};
+    EXPECT_EQ(nb_clusters, (atoms.nb_atoms() + 3) / 4);
+    std::vector<int> count(atoms.nb_atoms(), 0);
+    int nb_padding{0};
+    for (int I{0}; I < nb_clusters; ++I) {
+        for (int i : cluster_pair_list.cluster_atoms(I)) {
+            if (i < 0) {
+                nb_padding++;
+            } else {
+                count[i]++;
+            }
+        }
+    }
+    EXPECT_EQ(nb_padding, 4 * nb_clusters - atoms.nb_atoms());
+    EXPECT_TRUE(std::all_of(count.begin(), count.end(), [](int c) { return c == 1; }));
+
+    // Every pair of the neighbor list is in exactly one cluster pair
+    std::set<std::tuple<int, int>> pairs;
+    int nb_self_pairs{0};
+    for (auto [I, J] : cluster_pair_list) {
+        EXPECT_GE(J, I);
+        if (I == J) {
+            nb_self_pairs++;
+        }
+        for (int i : cluster_pair_list.cluster_atoms(I)) {
+            for (int j : cluster_pair_list.cluster_atoms(J)) {
+                if (i >= 0 && j >= 0 && (I != J || i != j)) {
+                    EXPECT_TRUE(pairs.insert({std::min(i, j), std::max(i, j)}).second || I == J);
+                }
+            }
+        }
+    }
+    EXPECT_EQ(nb_self_pairs, nb_clusters);
+    for (auto [i, j] : neighbor_list.pairs()) {
+        EXPECT_EQ(pairs.count({std::min(i, j), std::max(i, j)}), 1);
+    }
+
+    // Clusters are compact, hence far fewer atom pairs are visited than there
+    // are pairs of atoms in total
+    EXPECT_LT(16 * cluster_pair_list.nb_cluster_pairs(), atoms.nb_atoms() * atoms.nb_atoms() / 4);
+}
+
+TEST(ClusterPairListTest, EmptySystem) {
+    Atoms atoms(0);
+    ClusterPairList<4> cluster_pair_list;
+    cluster_pair_list.update(atoms, 5.0);
+    EXPECT_EQ(cluster_pair_list.nb_clusters(), 0);
+    EXPECT_EQ(cluster_pair_list.nb_cluster_pairs(), 0);
+    EXPECT_TRUE(cluster_pair_list.begin() == cluster_pair_list.end());
+}
@@ -0,0 +1,98 @@
+/*
+* Copyright 2021 Lars Pastewka
+*
+* ### MIT license
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <gtest/gtest.h>
+
+#include "atoms.h"
+#include "compressed_neighbor_list.h"
+#include "ducastelle.h"
+#include "neighbors.h"
+#include "spatial_sort.h"
+#include "xyz.h"
+
+TEST(CompressedNeighborListTest, SameNeighbors) {
+    constexpr int nb_atoms = 200;
+    constexpr double cutoff = 1.3;
+
+    // Random positions give neighbor indices that are spread out. The first
+    // atoms are far away in index space from atoms with huge indices, which
+    // need to be escaped.
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 3;
+    Atoms spread_atoms(70000);
+    for (int i{0}; i < spread_atoms.nb_atoms(); ++i) {
+        // Filler atoms on a grid that is coarser than the cutoff
+        spread_atoms.positions.col(i) << 10 + 2 * (i % 50), 2 * ((i / 50) % 50), 2 * (i / 2500);
+    }
+    spread_atoms.positions.leftCols(nb_atoms) = atoms.positions;
+    spread_atoms.positions.rightCols(nb_atoms) = atoms.positions.rowwise().reverse() + 0.1;
+
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(spread_atoms, cutoff);
+        CompressedNeighborList compressed_list(storage);
+        compressed_list.update(spread_atoms, cutoff);
+
+        EXPECT_EQ(compressed_list.nb_neighbors(), neighbor_list.nb_neighbors());
+        for (int i{0}; i < spread_atoms.nb_atoms(); ++i) {
+            std::vector<int> expected, found;
+            for (int j : neighbor_list.neighbors(i)) {
+                expected.push_back(j);
+            }
+            for (int j : compressed_list.neighbors(i)) {
+                found.push_back(j);
+            }
+            ASSERT_EQ(expected, found);
+        }
+    }
+}
+
+TEST(CompressedNeighborListTest, EmptySystem) {
+    Atoms atoms(0);
+    CompressedNeighborList compressed_list;
+    compressed_list.update(atoms, 1.0);
+    EXPECT_EQ(compressed_list.nb_neighbors(), 0);
+    EXPECT_EQ(compressed_list.nb_bytes(), 0);
+}
+
+TEST(CompressedNeighborListTest, Ducastelle) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms(names, positions);
+    sort_atoms(atoms, cutoff);
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double energy_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    CompressedNeighborList compressed_list;
+    compressed_list.update(atoms, cutoff);
+    EXPECT_NEAR(ducastelle(atoms, compressed_list, cutoff), energy_ref, 1e-10);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-10));
+
+    // After sorting, all neighbors fit into 16 bits
+    EXPECT_EQ(compressed_list.nb_bytes(), 2 * compressed_list.nb_neighbors());
+}
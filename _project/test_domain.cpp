@@ -31,6 +31,7 @@
 #include "neighbors.h"
 #include "units.h"
 #include "verlet.h"
+#include "virial.h"
 #include "xyz.h"
 
 // This test works at most with 4 mpi processes
@@ -102,6 +103,18 @@ TEST(DomainDecomposition, enable_disable) {
 
 }
 
+TEST(DomainDecomposition, enable_requires_types) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // Types are communicated with the atoms and need to have one entry per atom
+    Atoms atoms(4);
+    atoms.types.resize(3);
+    Domain comm(MPI_COMM_WORLD, {8, 2, 2}, {size, 1, 1}, {0, 0, 0});
+    EXPECT_THROW(comm.enable(atoms), std::runtime_error);
+    EXPECT_FALSE(comm.is_enabled());
+}
+
 // This test works at most with 4 mpi processes
 TEST(DomainDecomposition, exchange_atoms) {
     int size;
@@ -242,6 +255,50 @@ TEST(DomainDecomposition, update_ghosts) {
     }
 }
 
+TEST(DomainDecomposition, Ducastelle_periodic_neighbor_list) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+
+    // The domain is not decomposed, this test only runs on a single process
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (size != 1) {
+        return;
+    }
+
+    // Read gold cluster and construct Atoms object
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    // Move cluster into a periodic domain that is so small that the cluster
+    // interacts with its periodic images.
+    constexpr double vacuum = 0.5;  // distance to domain boundary on left and right
+    Eigen::Array3d minpos{atoms.positions.rowwise().minCoeff()}, maxpos{atoms.positions.rowwise().maxCoeff()};
+    atoms.positions.colwise() -= minpos - vacuum;
+    Eigen::Array3d domain_length{maxpos - minpos + 2 * vacuum};
+
+    // Energy and forces from a periodic neighbor list
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff, domain_length, {1, 1, 1});
+    double epot_periodic{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_periodic{atoms.forces};
+
+    // Energy and forces from ghost atoms replicated by the Domain class
+    Domain comm(MPI_COMM_WORLD, domain_length, {1, 1, 1}, {1, 1, 1});
+    comm.enable(atoms);
+    comm.update_ghosts(atoms, 2 * cutoff);
+    neighbor_list.update(atoms, cutoff);
+    atoms.energies.setZero();
+    ducastelle(atoms, neighbor_list, cutoff);
+    double epot_ghosts{atoms.energies(Eigen::seqN(0, comm.nb_local())).sum()};
+
+    EXPECT_NEAR(epot_periodic, epot_ghosts, 1e-9);
+    for (int i{0}; i < comm.nb_local(); ++i) {
+        EXPECT_NEAR(atoms.forces(0, i), forces_periodic(0, i), 1e-9);
+        EXPECT_NEAR(atoms.forces(1, i), forces_periodic(1, i), 1e-9);
+        EXPECT_NEAR(atoms.forces(2, i), forces_periodic(2, i), 1e-9);
+    }
+}
+
 class DomainDecompositionTest : public testing::TestWithParam<Eigen::Array3i> {
 };
 
@@ -317,6 +374,185 @@ TEST_P(DomainDecompositionTest, Ducastelle_energy_and_forces) {
     }
 }
 
+TEST_P(DomainDecompositionTest, Ducastelle_energy_and_forces_local_list) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+
+    // Get size of communicator group (number of processes)
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    std::cout << "Running test for decomposition " << GetParam().transpose() << std::endl;
+
+    if (GetParam().prod() != size) {
+        std::cout << "MPI communicator size of " << size << " is incompatible with this decomposition, skipping."
+                  << std::endl;
+        // Skip test if decomposition is incompatible with number of processes
+        return;
+    }
+
+    // Read gold cluster and construct Atoms object
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    // We abuse the masses as a unique index so we can find atoms again when decomposed
+    atoms.masses = Masses_t::LinSpaced(atoms.nb_atoms(), 0, atoms.nb_atoms() - 1);
+
+    // Compute energy on a single process
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double epot_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    // Get minimum and maximum x-position and move cluster into the domain (that starts at x=0)
+    constexpr double epsilon = 0.1;  // distance to domain boundary on left and right
+    double minx{atoms.positions.row(0).minCoeff()}, maxx{atoms.positions.row(0).maxCoeff()};
+    double miny{atoms.positions.row(1).minCoeff()}, maxy{atoms.positions.row(1).maxCoeff()};
+    double minz{atoms.positions.row(2).minCoeff()}, maxz{atoms.positions.row(2).maxCoeff()};
+    atoms.positions.row(0) -= minx - epsilon;
+    atoms.positions.row(1) -= miny - epsilon;
+    atoms.positions.row(2) -= minz - epsilon;
+
+    // Domain decomposition with boundary at domain length
+    Domain comm(MPI_COMM_WORLD,
+                {maxx - minx + 2 * epsilon, maxy - miny + 2 * epsilon, maxz - minz + 2 * epsilon},
+                GetParam(), {0, 0, 0});
+    comm.enable(atoms);
+    comm.update_ghosts(atoms, 2 * cutoff);
+
+    // Compute energy of decomposed system with a neighbor list that skips
+    // pairs between ghosts that are not neighbors of local atoms
+    neighbor_list.update(atoms, cutoff, 0.0, comm.nb_local(), 1);
+    atoms.energies.setZero();
+    atoms.forces.setZero();
+    ducastelle(atoms, neighbor_list, cutoff);
+
+    // We only sum the energy of the process-local atoms
+    double epot{atoms.energies(Eigen::seqN(0, comm.nb_local())).sum()};
+
+    // Sum energies of each process
+    double epot_sum;
+    MPI_Allreduce(&epot, &epot_sum, 1, MPI_DOUBLE, MPI_SUM, comm.communicator());
+
+    EXPECT_NEAR(epot_ref, epot_sum, 1e-10);
+
+    // Check forces on each process; only the process local atoms have valid forces
+    for (int i{0}; i < comm.nb_local(); ++i) {
+        Eigen::Index unique_index{static_cast<Eigen::Index>(atoms.masses(i))};
+        EXPECT_NEAR(atoms.forces(0, i), forces_ref(0, unique_index), 1e-10);
+        EXPECT_NEAR(atoms.forces(1, i), forces_ref(1, unique_index), 1e-10);
+        EXPECT_NEAR(atoms.forces(2, i), forces_ref(2, unique_index), 1e-10);
+    }
+}
+
+TEST_P(DomainDecompositionTest, Ducastelle_energy_and_forces_update_if_needed) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+    constexpr double skin = 0.5;  // Skin distance of the neighbor list
+
+    // Get size of communicator group (number of processes)
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (GetParam().prod() != size) {
+        // Skip test if decomposition is incompatible with number of processes
+        return;
+    }
+
+    // Read gold cluster and construct Atoms object
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    // We abuse the masses as a unique index so we can find atoms again when decomposed
+    atoms.masses = Masses_t::LinSpaced(atoms.nb_atoms(), 0, atoms.nb_atoms() - 1);
+
+    // Compute energy on a single process
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double epot_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    // Move cluster into the domain (that starts at x=0)
+    constexpr double epsilon = 0.1;  // distance to domain boundary on left and right
+    Eigen::Array3d minpos{atoms.positions.rowwise().minCoeff()}, maxpos{atoms.positions.rowwise().maxCoeff()};
+    atoms.positions.colwise() -= minpos - epsilon;
+
+    // Domain decomposition with boundary at domain length
+    Domain comm(MPI_COMM_WORLD, maxpos - minpos + 2 * epsilon, GetParam(), {0, 0, 0});
+    comm.enable(atoms);
+
+    // Exchange atoms, communicate ghosts and build the neighbor list with the
+    // default number of ghost shells
+    EXPECT_TRUE(comm.update_if_needed(atoms, neighbor_list, 2 * (cutoff + skin), cutoff, skin));
+
+    // Compute energy of decomposed system
+    atoms.energies.setZero();
+    atoms.forces.setZero();
+    ducastelle(atoms, neighbor_list, cutoff);
+
+    // We only sum the energy of the process-local atoms
+    double epot{atoms.energies(Eigen::seqN(0, comm.nb_local())).sum()};
+
+    // Sum energies of each process
+    double epot_sum;
+    MPI_Allreduce(&epot, &epot_sum, 1, MPI_DOUBLE, MPI_SUM, comm.communicator());
+
+    EXPECT_NEAR(epot_ref, epot_sum, 1e-10);
+
+    // Check forces on each process; only the process local atoms have valid forces
+    for (int i{0}; i < comm.nb_local(); ++i) {
+        Eigen::Index unique_index{static_cast<Eigen::Index>(atoms.masses(i))};
+        EXPECT_NEAR(atoms.forces(0, i), forces_ref(0, unique_index), 1e-10);
+        EXPECT_NEAR(atoms.forces(1, i), forces_ref(1, unique_index), 1e-10);
+        EXPECT_NEAR(atoms.forces(2, i), forces_ref(2, unique_index), 1e-10);
+    }
+}
+
+TEST_P(DomainDecompositionTest, Ducastelle_virial) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+
+    // Get size of communicator group (number of processes)
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (GetParam().prod() != size) {
+        // Skip test if decomposition is incompatible with number of processes
+        return;
+    }
+
+    // Read gold cluster and move it into a periodic domain that is small
+    // enough such that the cluster interacts with its periodic images
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    constexpr double vacuum = 0.5;  // distance to domain boundary on left and right
+    Eigen::Array3d minpos{atoms.positions.rowwise().minCoeff()}, maxpos{atoms.positions.rowwise().maxCoeff()};
+    atoms.positions.colwise() -= minpos - vacuum;
+    Eigen::Array3d domain_length{maxpos - minpos + 2 * vacuum};
+
+    // Virial from a periodic neighbor list on a single process
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff, domain_length, {1, 1, 1});
+    Virial virial_ref;
+    ducastelle(atoms, neighbor_list, virial_ref, cutoff);
+
+    // Virial from the local atoms and ghosts of each process
+    Domain comm(MPI_COMM_WORLD, domain_length, GetParam(), {1, 1, 1});
+    comm.enable(atoms);
+    comm.update_ghosts(atoms, 2 * cutoff);
+    neighbor_list.update(atoms, cutoff);
+    Virial virial(true);
+    virial.nb_local = comm.nb_local();
+    ducastelle(atoms, neighbor_list, virial, cutoff);
+
+    // Pairs between local atoms and ghosts count half on each of the two
+    // processes, and the per-atom virials of the local atoms add up to the
+    // total
+    Eigen::Array<double, 9, 1> local_virial{virial.per_atom.leftCols(comm.nb_local()).rowwise().sum()};
+    EXPECT_TRUE(Eigen::Map<Eigen::Matrix3d>(local_virial.data()).isApprox(virial.total, 1e-12));
+
+    Eigen::Matrix3d virial_sum;
+    MPI_Allreduce(virial.total.data(), virial_sum.data(), 9, MPI_DOUBLE, MPI_SUM, comm.communicator());
+    EXPECT_TRUE(virial_sum.isApprox(virial_ref.total, 1e-10));
+}
+
 TEST_P(DomainDecompositionTest, Ducastelle_moving_cluster) {
     constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
 
@@ -393,6 +629,149 @@ TEST_P(DomainDecompositionTest, Ducastelle_moving_cluster) {
     }
 }
 
+TEST_P(DomainDecompositionTest, Ducastelle_moving_cluster_with_skin) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+    constexpr double skin = 1.0;  // Skin distance of the neighbor list
+    constexpr int nb_steps = 20;
+
+    // Get size of communicator group (number of processes)
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (GetParam().prod() != size) {
+        // Skip test if decomposition is incompatible with number of processes
+        return;
+    }
+
+    // Read gold cluster and construct Atoms object
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    // Compute energy on a single process
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double epot_ref{ducastelle(atoms, neighbor_list, cutoff)};
+
+    // Move cluster into the domain (that starts at x=0)
+    constexpr double vacuum = 5.0;  // distance to domain boundary on left and right
+    Eigen::Array3d minpos{atoms.positions.rowwise().minCoeff()}, maxpos{atoms.positions.rowwise().maxCoeff()};
+    atoms.positions.colwise() -= minpos - vacuum;
+
+    // The cluster translates by 0.1 in each Cartesian direction per step and
+    // hence moves more than half the skin every three steps.
+    atoms.velocities.setConstant(0.1);
+
+    // Domain decomposition with periodic boundary at domain length
+    Domain comm(MPI_COMM_WORLD, maxpos - minpos + 2 * vacuum, GetParam(), {1, 1, 1});
+    comm.enable(atoms);
+    atoms.forces.setZero();
+
+    int nb_rebuilds{0};
+    for (int step{0}; step < nb_steps; ++step) {
+        // Position update.
+        verlet_step1(atoms, 1.0);
+
+        // Exchange atoms and rebuild the neighbor list only if necessary;
+        // otherwise only refresh the ghost positions.
+        if (comm.update_if_needed(atoms, neighbor_list, 2 * (cutoff + skin), cutoff, skin)) {
+            nb_rebuilds++;
+        }
+
+        // Compute energy of decomposed system
+        atoms.energies.setZero();
+        atoms.forces.setZero();
+        ducastelle(atoms, neighbor_list, cutoff);
+        atoms.forces.setZero();  // constant velocity
+
+        // We only sum the energy of the process-local atoms
+        double epot{atoms.energies(Eigen::seqN(0, comm.nb_local())).sum()};
+
+        // Sum energies of each process
+        double epot_sum;
+        MPI_Allreduce(&epot, &epot_sum, 1, MPI_DOUBLE, MPI_SUM, comm.communicator());
+
+        // Check that the energy does not change since the cluster is translating.
+        ASSERT_NEAR(epot_ref, epot_sum, 1e-10);
+
+        // Velocity correction. (Will do nothing here.)
+        verlet_step2(atoms, 1.0);
+    }
+
+    // The neighbor list should have been rebuilt every three steps.
+    EXPECT_EQ(nb_rebuilds, 7);
+}
+
+TEST_P(DomainDecompositionTest, Ducastelle_alloy_moving_cluster) {
+    constexpr double cutoff = 5.0;  // Cutoff for the Ducastelle potential
+
+    // Get size of communicator group (number of processes)
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (GetParam().prod() != size) {
+        // Skip test if decomposition is incompatible with number of processes
+        return;
+    }
+
+    // Cleri-Rosato parameters for Au and Ag; the Au-Ag parameters are
+    // averages and only serve to test the implementation
+    DucastelleParameters parameters({"Au", "Ag"});
+    parameters.set("Au", "Au", 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2));
+    parameters.set("Ag", "Ag", 0.1028, 1.178, 10.928, 3.139, 4.090 / sqrt(2));
+    parameters.set("Ag", "Au", 0.1545, 1.484, 10.579, 3.588, 4.085 / sqrt(2));
+
+    // Read gold cluster and turn every third atom into silver
+    auto[names, positions]{read_xyz("cluster_923.xyz")};
+    for (size_t i{0}; i < names.size(); i += 3) names[i] = "Ag";
+    Atoms atoms{names, positions};
+    atoms.types = parameters.element_indices(atoms.names);
+
+    // Compute energy on a single process
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double epot_ref{ducastelle(atoms, neighbor_list, parameters, cutoff)};
+
+    // Move cluster into the domain (that starts at x=0)
+    constexpr double vacuum = 2.5;  // distance to domain boundary on left and right
+    Eigen::Array3d minpos{atoms.positions.rowwise().minCoeff()}, maxpos{atoms.positions.rowwise().maxCoeff()};
+    atoms.positions.colwise() -= minpos - vacuum;
+
+    // The cluster translates, such that atoms migrate between the domains
+    // together with their types
+    atoms.velocities.setConstant(2);
+
+    // Domain decomposition with periodic boundary at domain length
+    Domain comm(MPI_COMM_WORLD, maxpos - minpos + 2 * vacuum, GetParam(), {1, 1, 1});
+    comm.enable(atoms);
+    atoms.forces.setZero();
+
+    for (int step{0}; step < 5; ++step) {
+        verlet_step1(atoms, 1.0);
+
+        comm.exchange_atoms(atoms);
+        comm.update_ghosts(atoms, 2 * cutoff);
+
+        // Compute energy of decomposed system; the ghosts need the types of
+        // the atoms they are images of
+        neighbor_list.update(atoms, cutoff);
+        atoms.energies.setZero();
+        ducastelle(atoms, neighbor_list, parameters, cutoff);
+        atoms.forces.setZero();  // constant velocity
+
+        // Sum energies of the process-local atoms of each process
+        double epot{atoms.energies(Eigen::seqN(0, comm.nb_local())).sum()};
+        double epot_sum;
+        MPI_Allreduce(&epot, &epot_sum, 1, MPI_DOUBLE, MPI_SUM, comm.communicator());
+        ASSERT_NEAR(epot_ref, epot_sum, 1e-10);
+
+        verlet_step2(atoms, 1.0);
+    }
+
+    // Types are gathered back in the replicated state
+    comm.disable(atoms);
+    EXPECT_EQ((atoms.types == 1).count(), (names.size() + 2) / 3);
+}
+
 INSTANTIATE_TEST_SUITE_P(CycleThroughDecompositions, DomainDecompositionTest,
                          testing::Values(Eigen::Array3i{1, 1, 1},
                                          Eigen::Array3i{2, 1, 1},
@@ -25,8 +25,16 @@
 #include <gtest/gtest.h>
 
 #include "atoms.h"
+#include "cluster_pair_list.h"
 #include "ducastelle.h"
 #include "neighbors.h"
+#include "spatial_sort.h"
+#include "virial.h"
+#include "xyz.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 TEST(DucastelleTest, Forces) {
     constexpr int nx = 2, ny = 2, nz = 2;
@@ -81,3 +89,455 @@ TEST(DucastelleTest, Forces) {
         }
     }
 }
+
+TEST(DucastelleTest, HalfList) {
+    constexpr double cutoff = 5.0;
+
+    // Read gold cluster and construct Atoms object
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    // Energies and forces must not depend on the storage mode of the list
+    NeighborList full_list;
+    full_list.update(atoms, cutoff);
+    double e_full{ducastelle(atoms, full_list, cutoff)};
+    Forces_t forces_full{atoms.forces};
+
+    NeighborList half_list(NeighborList::Storage::half);
+    half_list.update(atoms, cutoff);
+    EXPECT_EQ(2 * half_list.nb_neighbors(), full_list.nb_neighbors());
+    double e_half{ducastelle(atoms, half_list, cutoff)};
+
+    EXPECT_NEAR(e_full, e_half, 1e-10);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_full, 1e-10));
+}
+
+TEST(DucastelleTest, ClusterPairList) {
+    constexpr double cutoff = 5.0;
+
+    // Read gold cluster and construct Atoms object; 923 atoms do not divide
+    // into clusters of 4 or 8, hence the last cluster contains padding atoms
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double e_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    ClusterPairList<4> list4;
+    list4.update(atoms, cutoff);
+    EXPECT_NEAR(ducastelle(atoms, list4, cutoff), e_ref, 1e-9);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-9));
+
+    ClusterPairList<8> list8;
+    list8.update(atoms, cutoff);
+    EXPECT_NEAR(ducastelle(atoms, list8, cutoff), e_ref, 1e-9);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-9));
+}
+
+TEST(DucastelleTest, View) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double e_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    // A list built for a longer cutoff serves the potential through a view
+    NeighborList long_list(NeighborList::Storage::half, 2, true);
+    long_list.update(atoms, 1.5 * cutoff);
+    auto view{long_list.view(cutoff)};
+    int nb_pairs{0};
+    view.for_each_pair([&](int, int) { ++nb_pairs; });
+    EXPECT_EQ(2 * nb_pairs, neighbor_list.nb_neighbors());
+    EXPECT_NEAR(ducastelle(atoms, view, cutoff), e_ref, 1e-10);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-10));
+}
+
+TEST(DucastelleTest, PairGeometry) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff, 0.5);
+        double e_ref{ducastelle(atoms, neighbor_list, cutoff)};
+        Forces_t forces_ref{atoms.forces};
+
+        // Potential reads distances from the list
+        neighbor_list.update_pair_geometry(atoms.positions);
+        EXPECT_TRUE(neighbor_list.has_pair_geometry(atoms.positions));
+        EXPECT_NEAR(ducastelle(atoms, neighbor_list, cutoff), e_ref, 1e-10);
+        EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-10));
+
+        // Stored geometry is ignored once atoms have moved
+        atoms.positions(0, 0) += 0.1;
+        EXPECT_FALSE(neighbor_list.has_pair_geometry(atoms.positions));
+        double e_moved{ducastelle(atoms, neighbor_list, cutoff)};
+        Forces_t forces_moved{atoms.forces};
+        neighbor_list.update_pair_geometry(atoms.positions);
+        EXPECT_NEAR(ducastelle(atoms, neighbor_list, cutoff), e_moved, 1e-10);
+        EXPECT_TRUE(atoms.forces.isApprox(forces_moved, 1e-10));
+        atoms.positions(0, 0) -= 0.1;
+
+        // Rebuilding the list discards the geometry
+        neighbor_list.update(atoms, cutoff, 0.5);
+        EXPECT_FALSE(neighbor_list.has_pair_geometry(atoms.positions));
+    }
+}
+
+TEST(DucastelleTest, Vectorized) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff, 0.5);
+        double e_ref{ducastelle(atoms, neighbor_list, cutoff)};
+        Forces_t forces_ref{atoms.forces};
+
+        EXPECT_NEAR(ducastelle_vectorized(atoms, neighbor_list, cutoff), e_ref, 1e-10);
+        EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-12));
+    }
+}
+
+TEST(DucastelleTest, Virial) {
+    // The cutoff lies between two neighbor shells of gold, such that no pair
+    // crosses it under the small strains below
+    constexpr double cutoff = 6.0;
+    constexpr double delta = 1e-5;  // strain used for the finite difference computation of the virial
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff, 0.5);
+
+    Virial virial(true);
+    double e0{ducastelle(atoms, neighbor_list, virial, cutoff)};
+    Forces_t forces0{atoms.forces};
+    EXPECT_NEAR(ducastelle(atoms, neighbor_list, cutoff), e0, 1e-10);
+    EXPECT_TRUE((atoms.forces == forces0).all());
+
+    // Per-atom virials sum to the total
+    Eigen::Array<double, 9, 1> total{virial.per_atom.rowwise().sum()};
+    EXPECT_TRUE(Eigen::Map<Eigen::Matrix3d>(total.data()).isApprox(virial.total, 1e-12));
+    EXPECT_TRUE(virial.total.isApprox(virial.total.transpose(), 1e-12));
+
+    // The derivative of the energy with respect to a homogeneous strain
+    // epsilon_ab is -W_ab
+    for (int a{0}; a < 3; ++a) {
+        for (int b{0}; b < 3; ++b) {
+            atoms.positions.row(a) = positions.row(a) + delta * positions.row(b);
+            double eplus{ducastelle(atoms, neighbor_list, cutoff)};
+            atoms.positions.row(a) = positions.row(a) - delta * positions.row(b);
+            double eminus{ducastelle(atoms, neighbor_list, cutoff)};
+            atoms.positions = positions;
+            EXPECT_NEAR(-(eplus - eminus) / (2 * delta), virial.total(a, b), 1e-5 * virial.total.norm());
+        }
+    }
+
+    // All storage modes and thread schedules give the same virial
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList other_neighbor_list(storage);
+        other_neighbor_list.update(atoms, cutoff);
+        for (auto schedule : {ThreadSchedule::serial, ThreadSchedule::buffers, ThreadSchedule::coloring,
+                              ThreadSchedule::gather}) {
+            if (storage == NeighborList::Storage::half && schedule == ThreadSchedule::gather)
+                continue;
+            Virial other_virial(true);
+            ducastelle(atoms, other_neighbor_list, other_virial, cutoff, 0.2061, 1.790, 10.229, 4.036,
+                       4.079 / sqrt(2), schedule);
+            EXPECT_TRUE(other_virial.total.isApprox(virial.total, 1e-12));
+            EXPECT_TRUE(other_virial.per_atom.isApprox(virial.per_atom, 1e-12));
+        }
+    }
+}
+
+TEST(DucastelleTest, AlloyWithOneElement) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+
+    double e_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    DucastelleParameters parameters({"Au"});
+    parameters.set("Au", "Au", 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2));
+    EXPECT_NEAR(ducastelle(atoms, neighbor_list, parameters, cutoff), e_ref, 1e-10);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-12));
+}
+
+TEST(DucastelleTest, AlloyForces) {
+    constexpr int nx = 2, ny = 2, nz = 2;
+    constexpr double lattice_constant = 2.9;
+    constexpr double cutoff = 5.0;
+    constexpr double delta = 0.0001;  // difference used for numerical (finite difference) computation of forces
+
+    // Cleri-Rosato parameters for Au and Ag; the Au-Ag parameters are
+    // averages and only serve to test the implementation
+    DucastelleParameters parameters({"Au", "Ag"});
+    parameters.set("Au", "Au", 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2));
+    parameters.set("Ag", "Ag", 0.1028, 1.178, 10.928, 3.139, 4.090 / sqrt(2));
+    EXPECT_FALSE(parameters.is_complete());
+    parameters.set("Ag", "Au", 0.1545, 1.484, 10.579, 3.588, 4.085 / sqrt(2));
+    EXPECT_TRUE(parameters.is_complete());
+
+    Atoms atoms(nx * ny * nz);
+
+    // we create a cubic lattice with random displacements and alternating
+    // elements
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 0.1;
+    for (int x{0}, i{0}; x < nx; ++x) {
+        for (int y{0}; y < ny; ++y) {
+            for (int z{0}; z < nz; ++z, ++i) {
+                atoms.positions(0, i) += x * lattice_constant;
+                atoms.positions(1, i) += y * lattice_constant;
+                atoms.positions(2, i) += z * lattice_constant;
+                atoms.names[i] = (x + y + z) % 2 ? "Ag" : "Au";
+            }
+        }
+    }
+
+    atoms.types = parameters.element_indices(atoms.names);
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    ducastelle(atoms, neighbor_list, parameters, cutoff);
+    Forces_t forces0{atoms.forces};
+
+    // loop over all atoms and compute forces from a finite differences approximation
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        // loop over all Cartesian directions
+        for (int j{0}; j < 3; ++j) {
+            // move atom to the right
+            atoms.positions(j, i) += delta;
+            neighbor_list.update(atoms, cutoff);
+            double eplus{ducastelle(atoms, neighbor_list, parameters, cutoff)};
+            // move atom to the left
+            atoms.positions(j, i) -= 2 * delta;
+            neighbor_list.update(atoms, cutoff);
+            double eminus{ducastelle(atoms, neighbor_list, parameters, cutoff)};
+            // move atom back to original position
+            atoms.positions(j, i) += delta;
+
+            // finite-differences forces
+            double fd_force{-(eplus - eminus) / (2 * delta)};
+
+            // check whether finite-difference and analytic forces agree
+            if (abs(forces0(j, i)) > 1e-10) {
+                EXPECT_NEAR(abs(fd_force - forces0(j, i)) / forces0(j, i), 0, 1e-5);
+            } else {
+                EXPECT_NEAR(fd_force, forces0(j, i), 1e-10);
+            }
+        }
+    }
+
+    // Elements without parameters are rejected
+    atoms.names[0] = "Cu";
+    EXPECT_THROW(parameters.element_indices(atoms.names), std::runtime_error);
+    atoms.types(0) = 2;
+    EXPECT_THROW(ducastelle(atoms, neighbor_list, parameters, cutoff), std::runtime_error);
+
+    // Every atom needs a type
+    atoms.types.resize(atoms.nb_atoms() - 1);
+    EXPECT_THROW(ducastelle(atoms, neighbor_list, parameters, cutoff), std::runtime_error);
+}
+
+TEST(DucastelleTest, MixedPrecision) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff);
+        double e_ref{ducastelle_vectorized(atoms, neighbor_list, cutoff)};
+        Forces_t forces_ref{atoms.forces};
+
+        EXPECT_NEAR(ducastelle_mixed_precision(atoms, neighbor_list, cutoff), e_ref, 1e-7 * std::abs(e_ref));
+        EXPECT_LT((atoms.forces - forces_ref).abs().maxCoeff(), 2e-5);
+    }
+}
+
+TEST(DucastelleTest, MixedPrecisionEnergyDrift) {
+    // The cutoff lies between the fourth and fifth neighbor shell of gold,
+    // such that few pairs cross it
+    constexpr double cutoff = 6.0, skin = 1.0;
+    constexpr double mass = 196.97;  // atomic mass of gold, time unit is 10.18 fs
+    constexpr double timestep = 0.2;
+    constexpr int nb_steps = 1000;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Velocities_t velocities{Velocities_t::Random(3, positions.cols()) * 0.02};
+
+    // Run velocity-Verlet and return the total energy after each step
+    auto energy_trace = [&](auto &&potential) {
+        Atoms atoms{names, positions, velocities};
+        NeighborList neighbor_list;
+        neighbor_list.update_if_needed(atoms, cutoff, skin);
+        Eigen::ArrayXd energies(nb_steps + 1);
+        energies(0) = potential(atoms, neighbor_list) + 0.5 * mass * atoms.velocities.square().sum();
+        for (int step{1}; step <= nb_steps; ++step) {
+            atoms.velocities += 0.5 * timestep * atoms.forces / mass;
+            atoms.positions += timestep * atoms.velocities;
+            neighbor_list.update_if_needed(atoms, cutoff, skin);
+            double epot{potential(atoms, neighbor_list)};
+            // The kinetic energy is taken after the second half-kick, at the
+            // same time as the positions
+            atoms.velocities += 0.5 * timestep * atoms.forces / mass;
+            energies(step) = epot + 0.5 * mass * atoms.velocities.square().sum();
+        }
+        return energies;
+    };
+
+    // Least-squares slope of the energy per step
+    auto drift_slope = [](const Eigen::ArrayXd &energies) {
+        Eigen::ArrayXd steps{Eigen::ArrayXd::LinSpaced(energies.size(), 0, energies.size() - 1)};
+        steps -= steps.mean();
+        return (steps * (energies - energies.mean())).sum() / steps.square().sum();
+    };
+
+    Eigen::ArrayXd energies_double{energy_trace([&](Atoms &atoms, const NeighborList &neighbor_list) {
+        return ducastelle_vectorized(atoms, neighbor_list, cutoff);
+    })};
+    Eigen::ArrayXd energies_mixed{energy_trace([&](Atoms &atoms, const NeighborList &neighbor_list) {
+        return ducastelle_mixed_precision(atoms, neighbor_list, cutoff);
+    })};
+
+    // The energy fluctuates because of the truncation of the potential.
+    // Single precision shifts the energy by a nearly constant offset of less
+    // than 1e-6 eV per atom and adds no systematic drift over 2 ps.
+    const double nb_atoms(names.size());
+    EXPECT_LT((energies_double - energies_double(0)).abs().maxCoeff(), 1e-3 * nb_atoms);
+    EXPECT_LT((energies_mixed - energies_double).abs().maxCoeff(), 1e-6 * nb_atoms);
+    EXPECT_NEAR(drift_slope(energies_mixed) * nb_steps, drift_slope(energies_double) * nb_steps, 1e-7 * nb_atoms);
+}
+
+#ifdef _OPENMP
+TEST(DucastelleTest, IndependentOfNumberOfThreads) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    sort_atoms(atoms, cutoff);
+
+    int nb_threads{omp_get_max_threads()};
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff);
+        omp_set_num_threads(1);
+        double e_serial{ducastelle(atoms, neighbor_list, cutoff)};
+        Forces_t forces_serial{atoms.forces};
+
+        std::vector<ThreadSchedule> schedules{ThreadSchedule::buffers, ThreadSchedule::coloring};
+        if (storage == NeighborList::Storage::full)
+            schedules.push_back(ThreadSchedule::gather);
+        for (auto schedule : schedules) {
+            for (int nb_threads : {2, 3, 4}) {
+                omp_set_num_threads(nb_threads);
+                double e{ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2),
+                                    schedule)};
+                Forces_t forces{atoms.forces};
+                EXPECT_NEAR(e, e_serial, 1e-10);
+                EXPECT_TRUE(forces.isApprox(forces_serial, 1e-12));
+
+                // Repeated evaluation gives identical results
+                EXPECT_EQ(ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2),
+                                     schedule),
+                          e);
+                EXPECT_TRUE((atoms.forces == forces).all());
+            }
+        }
+    }
+    omp_set_num_threads(nb_threads);
+}
+
+TEST(DucastelleTest, SmallerThreadTeams) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double e_ref{ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2),
+                            ThreadSchedule::serial)};
+    Forces_t forces_ref{atoms.forces};
+
+    std::vector<ThreadSchedule> schedules{ThreadSchedule::buffers, ThreadSchedule::coloring, ThreadSchedule::gather};
+
+    // The runtime may start fewer threads than `omp_get_max_threads()`
+    omp_set_dynamic(1);
+    for (auto schedule : schedules) {
+        double e{ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2), schedule)};
+        EXPECT_NEAR(e, e_ref, 1e-10);
+        EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-12));
+    }
+    omp_set_dynamic(0);
+
+    // Inside an active parallel region, nested regions run with a single
+    // thread while `omp_get_max_threads()` still reports the full team
+    int max_active_levels{omp_get_max_active_levels()};
+    omp_set_max_active_levels(1);
+    for (auto schedule : schedules) {
+        std::vector<double> energies(2);
+        std::vector<Forces_t> forces(2);
+#pragma omp parallel num_threads(2)
+        {
+            Atoms thread_atoms{atoms};
+            energies[omp_get_thread_num()] = ducastelle(thread_atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229,
+                                                        4.036, 4.079 / sqrt(2), schedule);
+            forces[omp_get_thread_num()] = thread_atoms.forces;
+        }
+        for (int thread{0}; thread < 2; ++thread) {
+            EXPECT_NEAR(energies[thread], e_ref, 1e-10);
+            EXPECT_TRUE(forces[thread].isApprox(forces_ref, 1e-12));
+        }
+    }
+    omp_set_max_active_levels(max_active_levels);
+
+    // With a single thread (e.g. `OMP_NUM_THREADS=1`) the kernel runs
+    // serially in the calling team, whose thread index may be nonzero
+    schedules.push_back(ThreadSchedule::serial);
+    for (auto schedule : schedules) {
+        std::vector<double> energies(2);
+        std::vector<Forces_t> forces(2);
+#pragma omp parallel num_threads(2)
+        {
+            omp_set_num_threads(1);
+            Atoms thread_atoms{atoms};
+            energies[omp_get_thread_num()] = ducastelle(thread_atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229,
+                                                        4.036, 4.079 / sqrt(2), schedule);
+            forces[omp_get_thread_num()] = thread_atoms.forces;
+        }
+        for (int thread{0}; thread < 2; ++thread) {
+            EXPECT_NEAR(energies[thread], e_ref, 1e-10);
+            EXPECT_TRUE(forces[thread].isApprox(forces_ref, 1e-12));
+        }
+    }
+}
+#endif
+
+TEST(DucastelleTest, GatherRequiresFullList) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list(NeighborList::Storage::half);
+    neighbor_list.update(atoms, cutoff);
+    EXPECT_THROW(ducastelle(atoms, neighbor_list, cutoff, 0.2061, 1.790, 10.229, 4.036, 4.079 / sqrt(2),
+                            ThreadSchedule::gather),
+                 std::runtime_error);
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "atoms.h"
+#include "ducastelle.h"
+#include "eam.h"
+#include "neighbors.h"
+#include "xyz.h"
+
+// Cleri-Rosato parameters for gold, see `ducastelle`
+static constexpr double A{0.2061}, xi{1.790}, p{10.229}, q{4.036}, re{4.079 / 1.4142135623730951};
+static constexpr double cutoff{5.0};
+
+// Tables of the Ducastelle potential
+static constexpr int nb_rho{5001}, nb_r{5001};
+static constexpr double drho{100.0 / (nb_rho - 1)}, dr{cutoff / (nb_r - 1)};
+
+static double ducastelle_embedding(double rho) { return -std::sqrt(rho); }
+
+static double ducastelle_density(double r) { return xi * xi * std::exp(-2 * q * (r / re - 1)); }
+
+static double ducastelle_pair(double r) { return 2 * A * std::exp(-p * (r / re - 1)); }
+
+/*
+ * Write the tabulated Ducastelle potential for each of the given elements in
+ * setfl format
+ */
+static void write_ducastelle_setfl(std::ostream &file, const std::vector<std::string> &elements) {
+    file.precision(17);
+    file << "Ducastelle potential for gold\n\n\n";
+    file << elements.size();
+    for (auto &element : elements) file << " " << element;
+    file << "\n" << nb_rho << " " << drho << " " << nb_r << " " << dr << " " << cutoff << "\n";
+    for (size_t a{0}; a < elements.size(); ++a) {
+        file << "79 196.97 4.079 fcc\n";
+        for (int k{0}; k < nb_rho; ++k) file << ducastelle_embedding(k * drho) << (k % 5 == 4 ? "\n" : " ");
+        for (int k{0}; k < nb_r; ++k) file << ducastelle_density(k * dr) << (k % 5 == 4 ? "\n" : " ");
+    }
+    for (size_t k{0}; k < elements.size() * (elements.size() + 1) / 2; ++k) {
+        for (int l{0}; l < nb_r; ++l) file << l * dr * ducastelle_pair(l * dr) << "\n";
+    }
+}
+
+/*
+ * Write the tabulated Ducastelle potential in funcfl format; Z(r) is given in
+ * units of sqrt(Hartree * Bohr)
+ */
+static void write_ducastelle_funcfl(std::ostream &file) {
+    file.precision(17);
+    file << "Ducastelle potential for gold\n";
+    file << "79 196.97 4.079 fcc\n";
+    file << nb_rho << " " << drho << " " << nb_r << " " << dr << " " << cutoff << "\n";
+    for (int k{0}; k < nb_rho; ++k) file << ducastelle_embedding(k * drho) << "\n";
+    for (int k{0}; k < nb_r; ++k) file << std::sqrt(k * dr * ducastelle_pair(k * dr) / (27.2 * 0.529)) << "\n";
+    for (int k{0}; k < nb_r; ++k) file << ducastelle_density(k * dr) << "\n";
+}
+
+TEST(EAMTest, Spline) {
+    constexpr int nb_pts = 101;
+    constexpr double x0 = 1, dx = 0.05;
+    Eigen::ArrayXd values{(x0 + dx * Eigen::ArrayXd::LinSpaced(nb_pts, 0, nb_pts - 1)).sin()};
+    UniformCubicSpline spline(x0, dx, values);
+
+    // Spline passes through the grid points
+    for (int k{0}; k < nb_pts; ++k) {
+        EXPECT_NEAR(spline(x0 + k * dx), values(k), 1e-12);
+    }
+
+    // and approximates function and derivative in between. (Close to the
+    // ends, the natural boundary conditions spoil the approximation, since
+    // the second derivative of the sine does not vanish there.)
+    for (double x{x0 + 10 * dx}; x < x0 + (nb_pts - 11) * dx; x += 0.0123) {
+        auto [value, derivative]{spline.evaluate(x)};
+        EXPECT_NEAR(value, std::sin(x), 1e-6);
+        EXPECT_NEAR(derivative, std::cos(x), 1e-4);
+    }
+
+    // Linear continuation beyond the last grid point
+    double x_end{x0 + (nb_pts - 1) * dx};
+    auto [value_end, derivative_end]{spline.evaluate(x_end)};
+    EXPECT_NEAR(spline(x_end + 0.5), value_end + 0.5 * derivative_end, 1e-12);
+}
+
+TEST(EAMTest, AgreesWithDucastelle) {
+    std::stringstream setfl;
+    write_ducastelle_setfl(setfl, {"Au"});
+    auto potential{EAMPotential::read_setfl(setfl)};
+    EXPECT_EQ(potential.elements(), std::vector<std::string>{"Au"});
+    EXPECT_DOUBLE_EQ(potential.cutoff(), cutoff);
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff);
+        double e_ref{ducastelle(atoms, neighbor_list, cutoff, A, xi, p, q, re)};
+        Forces_t forces_ref{atoms.forces};
+
+        EXPECT_NEAR(eam(atoms, neighbor_list, potential), e_ref, 1e-6 * std::abs(e_ref));
+        EXPECT_LT((atoms.forces - forces_ref).abs().maxCoeff(), 1e-6);
+
+        // Virial
+        Virial virial_ref(true), virial(true);
+        ducastelle(atoms, neighbor_list, virial_ref, cutoff, A, xi, p, q, re);
+        eam(atoms, neighbor_list, potential, virial);
+        EXPECT_LT((virial.total - virial_ref.total).cwiseAbs().maxCoeff(), 1e-6 * virial_ref.total.norm());
+        EXPECT_LT((virial.per_atom - virial_ref.per_atom).abs().maxCoeff(), 1e-6);
+    }
+}
+
+TEST(EAMTest, Funcfl) {
+    // The same potential in funcfl format
+    std::stringstream funcfl, setfl;
+    write_ducastelle_funcfl(funcfl);
+    auto funcfl_potential{EAMPotential::read_funcfl(funcfl, "Au")};
+    write_ducastelle_setfl(setfl, {"Au"});
+    auto setfl_potential{EAMPotential::read_setfl(setfl)};
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double e_setfl{eam(atoms, neighbor_list, setfl_potential)};
+    Forces_t forces_setfl{atoms.forces};
+    EXPECT_NEAR(eam(atoms, neighbor_list, funcfl_potential), e_setfl, 1e-10 * std::abs(e_setfl));
+    EXPECT_TRUE(atoms.forces.isApprox(forces_setfl, 1e-10));
+}
+
+TEST(EAMTest, Alloy) {
+    // Two elements with identical tables behave like a single element
+    std::stringstream setfl, unary_setfl;
+    write_ducastelle_setfl(setfl, {"Au", "Ag"});
+    auto potential{EAMPotential::read_setfl(setfl)};
+    write_ducastelle_setfl(unary_setfl, {"Au"});
+    auto unary_potential{EAMPotential::read_setfl(unary_setfl)};
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    double e_ref{eam(atoms, neighbor_list, unary_potential)};
+    Forces_t forces_ref{atoms.forces};
+
+    for (int i{0}; i < atoms.nb_atoms(); i += 3) atoms.names[i] = "Ag";
+    atoms.types = potential.element_indices(atoms.names);
+    EXPECT_NEAR(eam(atoms, neighbor_list, potential), e_ref, 1e-10 * std::abs(e_ref));
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref, 1e-10));
+
+    atoms.names[0] = "Cu";
+    EXPECT_THROW(potential.element_indices(atoms.names), std::runtime_error);
+    atoms.types(0) = 2;
+    EXPECT_THROW(eam(atoms, neighbor_list, potential), std::runtime_error);
+
+    atoms.types.resize(atoms.nb_atoms() - 1);
+    EXPECT_THROW(eam(atoms, neighbor_list, potential), std::runtime_error);
+}
+
+TEST(EAMTest, Forces) {
+    constexpr double delta = 0.0001;  // difference used for numerical (finite difference) computation of forces
+
+    std::stringstream setfl;
+    write_ducastelle_setfl(setfl, {"Au"});
+    auto potential{EAMPotential::read_setfl(setfl)};
+
+    // small fcc cluster with random displacements
+    Atoms atoms(27);
+    atoms.positions.setRandom();
+    atoms.positions *= 0.1;
+    for (int x{0}, i{0}; x < 3; ++x) {
+        for (int y{0}; y < 3; ++y) {
+            for (int z{0}; z < 3; ++z, ++i) {
+                atoms.positions.col(i) += 2.9 * Eigen::Array3i{x, y, z}.cast<double>();
+            }
+        }
+    }
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    eam(atoms, neighbor_list, potential);
+    Forces_t forces0{atoms.forces};
+
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        for (int j{0}; j < 3; ++j) {
+            atoms.positions(j, i) += delta;
+            neighbor_list.update(atoms, cutoff);
+            double eplus{eam(atoms, neighbor_list, potential)};
+            atoms.positions(j, i) -= 2 * delta;
+            neighbor_list.update(atoms, cutoff);
+            double eminus{eam(atoms, neighbor_list, potential)};
+            atoms.positions(j, i) += delta;
+
+            EXPECT_NEAR(-(eplus - eminus) / (2 * delta), forces0(j, i), 1e-5);
+        }
+    }
+}
@@ -26,8 +26,14 @@
 #include "neighbors.h"
 #include "xyz.h"
 
+#include <numeric>
+
 #include <gtest/gtest.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 TEST(NeighborsTest, Test1) {
     Names_t names{{"H", "H", "H", "H"}};
     Positions_t positions(3, 4);
@@ -141,3 +147,442 @@ TEST(NeighborsTest, AtomsHaveNoNeighbors) {
 }
 
 
+
+
+TEST(NeighborsTest, SkinDistance) {
+    Names_t names{{"H", "H", "H"}};
+    Positions_t positions(3, 3);
+    positions << 0, 1, 2.4,
+                 0, 0, 0,
+                 0, 0, 0;
+
+    Atoms atoms(names, positions);
+    NeighborList neighbor_list;
+
+    // First call always builds the list. Atom 2 is within cutoff + skin of
+    // atom 1 and hence already part of the list.
+    EXPECT_TRUE(neighbor_list.update_if_needed(atoms, 1.1, 0.4));
+    EXPECT_EQ(neighbor_list.nb_neighbors(), 4);
+
+    // Moving by less than half the skin does not trigger a rebuild.
+    atoms.positions(0, 2) -= 0.15;
+    EXPECT_FALSE(neighbor_list.update_if_needed(atoms, 1.1, 0.4));
+
+    // Moving by more than half the skin triggers a rebuild.
+    atoms.positions(0, 2) -= 0.1;
+    EXPECT_TRUE(neighbor_list.update_if_needed(atoms, 1.1, 0.4));
+    EXPECT_FALSE(neighbor_list.update_if_needed(atoms, 1.1, 0.4));
+
+    // Changing the cutoff triggers a rebuild.
+    EXPECT_TRUE(neighbor_list.update_if_needed(atoms, 0.5, 0.4));
+    EXPECT_EQ(neighbor_list.nb_neighbors(), 0);
+}
+
+
+TEST(NeighborsTest, HalfList) {
+    Names_t names{{"H", "H", "H", "H"}};
+    Positions_t positions(3, 4);
+    positions << 0, 1, 0, 0,
+                 0, 0, 1, -1,
+                 0, 0, 0, 0;
+
+    Atoms atoms(names, positions);
+    NeighborList full_list;
+    full_list.update(atoms, 1.5);
+    NeighborList half_list(NeighborList::Storage::half);
+    auto &[seed, neighbors]{half_list.update(atoms, 1.5)};
+
+    // Each pair is stored only once, either in the row of i or of j
+    EXPECT_TRUE(half_list.is_half());
+    EXPECT_EQ(half_list.nb_neighbors(), 5);
+    EXPECT_EQ(2 * half_list.nb_neighbors(), full_list.nb_neighbors());
+
+    // Pair iteration yields the same pairs for the full and the half list
+    std::vector<std::tuple<int, int>> full_pairs, half_pairs;
+    for (auto [i, j]: full_list.pairs()) {
+        EXPECT_LT(i, j);
+        full_pairs.push_back({i, j});
+    }
+    for (auto [i, j]: half_list.pairs()) {
+        half_pairs.push_back({std::min(i, j), std::max(i, j)});
+    }
+    std::sort(full_pairs.begin(), full_pairs.end());
+    std::sort(half_pairs.begin(), half_pairs.end());
+    EXPECT_EQ(full_pairs, (std::vector<std::tuple<int, int>>{{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}}));
+    EXPECT_EQ(full_pairs, half_pairs);
+
+    // Atom-major access yields the same neighbors and pairs
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        EXPECT_EQ(half_list.neighbors(i).size(), half_list.nb_neighbors(i));
+        EXPECT_TRUE((half_list.neighbors(i) == neighbors(Eigen::seq(seed(i), seed(i + 1) - 1))).all());
+    }
+    std::vector<std::tuple<int, int>> full_for_each, half_for_each;
+    full_list.for_each_pair([&](int i, int j) { full_for_each.push_back({i, j}); });
+    half_list.for_each_pair([&](int i, int j) { half_for_each.push_back({std::min(i, j), std::max(i, j)}); });
+    std::sort(full_for_each.begin(), full_for_each.end());
+    std::sort(half_for_each.begin(), half_for_each.end());
+    EXPECT_EQ(full_for_each, full_pairs);
+    EXPECT_EQ(half_for_each, half_pairs);
+    int nb_full_neighbors{0};
+    full_list.for_each_neighbor([&](int, int) { nb_full_neighbors++; });
+    EXPECT_EQ(nb_full_neighbors, full_list.nb_neighbors());
+}
+
+
+/*
+ * Return all pairs (i, j) with i < j that are within the cutoff, using the
+ * minimum image convention in periodic directions
+ */
+static std::vector<std::tuple<int, int>> direct_search(const Positions_t &positions, double cutoff,
+                                                       const Eigen::Array3d &domain_length,
+                                                       const Eigen::Array3i &periodicity) {
+    std::vector<std::tuple<int, int>> pairs;
+    for (int i{0}; i < positions.cols(); ++i) {
+        for (int j{i + 1}; j < positions.cols(); ++j) {
+            Eigen::Array3d distance_vector{positions.col(i) - positions.col(j)};
+            for (int dim{0}; dim < 3; ++dim) {
+                if (periodicity(dim)) {
+                    distance_vector(dim) -= domain_length(dim) * std::round(distance_vector(dim) / domain_length(dim));
+                }
+            }
+            if (distance_vector.matrix().norm() <= cutoff) {
+                pairs.push_back({i, j});
+            }
+        }
+    }
+    return pairs;
+}
+
+/*
+ * Return all pairs stored in the neighbor list as (i, j) with i < j. Pairs of
+ * a full list are reported only once, but we check that they are stored
+ * twice.
+ */
+static std::vector<std::tuple<int, int>> sorted_pairs(const NeighborList &neighbor_list) {
+    std::vector<std::tuple<int, int>> pairs, reversed_pairs;
+    for (auto [i, j] : neighbor_list) {
+        if (i < j) {
+            pairs.push_back({i, j});
+        } else {
+            reversed_pairs.push_back({j, i});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    std::sort(reversed_pairs.begin(), reversed_pairs.end());
+    if (neighbor_list.is_half()) {
+        pairs.insert(pairs.end(), reversed_pairs.begin(), reversed_pairs.end());
+        std::sort(pairs.begin(), pairs.end());
+    } else {
+        EXPECT_EQ(pairs, reversed_pairs);
+    }
+    return pairs;
+}
+
+
+TEST(NeighborsTest, AgreesWithDirectSearch) {
+    constexpr int nb_atoms = 200;
+    constexpr double cutoff = 1.3;
+
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 3;
+    // Put some atoms exactly onto the boundary of the bounding box
+    atoms.positions(0, 0) = 3;
+    atoms.positions(1, 1) = -3;
+
+    NeighborList neighbor_list;
+    auto &[seed, neighbors]{neighbor_list.update(atoms, cutoff)};
+
+    // Compare to O(N^2) search over all pairs
+    for (int i{0}; i < nb_atoms; ++i) {
+        std::vector<int> expected, found;
+        for (int j{0}; j < nb_atoms; ++j) {
+            if (i != j && (atoms.positions.col(i) - atoms.positions.col(j)).matrix().norm() <= cutoff) {
+                expected.push_back(j);
+            }
+        }
+        for (int n{seed(i)}; n < seed(i + 1); ++n) {
+            found.push_back(neighbors(n));
+        }
+        std::sort(found.begin(), found.end());
+        EXPECT_EQ(expected, found);
+    }
+
+    // Smaller cells and the half shell stencil find the same pairs
+    auto expected{direct_search(atoms.positions, cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero())};
+    for (int bins_per_cutoff : {1, 2, 3}) {
+        for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+            NeighborList neighbor_list(storage, bins_per_cutoff);
+            neighbor_list.update(atoms, cutoff);
+            EXPECT_EQ(sorted_pairs(neighbor_list), expected);
+        }
+    }
+}
+
+
+TEST(NeighborsTest, Periodic) {
+    constexpr int nb_atoms = 200;
+    constexpr double cutoff = 1.3;
+    Eigen::Array3i periodicity{1, 1, 0};
+
+    // The second domain has only two cells in y direction, hence the left and
+    // right neighbor cells are the same.
+    for (Eigen::Array3d domain_length : {Eigen::Array3d{6, 2.7, 4}, Eigen::Array3d{6, 5.3, 4}}) {
+        Atoms atoms(nb_atoms);
+        atoms.positions.setRandom();  // random numbers between -1 and 1
+        atoms.positions = (atoms.positions + 1).colwise() * domain_length / 2;
+        // Some atoms sit outside of the periodic domain
+        atoms.positions(0, 0) = -0.5;
+        atoms.positions(1, 1) = domain_length(1) + 0.8;
+
+        auto expected{direct_search(atoms.positions, cutoff, domain_length, periodicity)};
+        for (int bins_per_cutoff : {1, 2, 3}) {
+            for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+                NeighborList neighbor_list(storage, bins_per_cutoff);
+                neighbor_list.update(atoms, cutoff, domain_length, periodicity);
+
+                // Compare to O(N^2) search over all pairs using the minimum image convention
+                EXPECT_EQ(sorted_pairs(neighbor_list), expected);
+                for (auto [i, j] : expected) {
+                    Eigen::Array3d distance_vector{atoms.positions.col(i) - atoms.positions.col(j)};
+                    distance_vector.head(2) -= domain_length.head(2) * (distance_vector.head(2) / domain_length.head(2)).round();
+                    EXPECT_TRUE(neighbor_list.distance_vector(atoms.positions, i, j).isApprox(distance_vector.matrix()));
+                }
+            }
+        }
+    }
+
+    // Domain is too small for the minimum image convention
+    Atoms atoms(nb_atoms);
+    NeighborList neighbor_list;
+    EXPECT_THROW(neighbor_list.update(atoms, 1.4, {6, 2.7, 4}, periodicity), std::runtime_error);
+}
+
+
+TEST(NeighborsTest, OutlyingAtoms) {
+    constexpr int nb_atoms = 200;
+    constexpr double cutoff = 1.3;
+
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 3;
+    // A few atoms have evaporated far away; the enclosing rectangle would
+    // contain more cells than fit into memory. Two of them are neighbors.
+    atoms.positions.col(0) << 1e4, 0, 0;
+    atoms.positions.col(1) << 0, -3e7, 2e9;
+    atoms.positions.col(2) << 0, -3e7, 2e9 + 1;
+
+    auto expected{direct_search(atoms.positions, cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero())};
+    for (int bins_per_cutoff : {1, 2}) {
+        for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+            NeighborList neighbor_list(storage, bins_per_cutoff);
+            neighbor_list.update(atoms, cutoff);
+            EXPECT_EQ(sorted_pairs(neighbor_list), expected);
+        }
+    }
+
+    // The same in a domain that is periodic in the plane
+    Eigen::Array3d domain_length{6, 6, 1};
+    Eigen::Array3i periodicity{1, 1, 0};
+    atoms.positions.topRows(2) = (atoms.positions.topRows(2) + 3) / 6 * 5.9;
+    expected = direct_search(atoms.positions, cutoff, domain_length, periodicity);
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff, domain_length, periodicity);
+        EXPECT_EQ(sorted_pairs(neighbor_list), expected);
+    }
+}
+
+
+TEST(NeighborsTest, GhostShells) {
+    constexpr int nb_atoms = 400, nb_local = 100;
+    constexpr double cutoff = 1.3;
+
+    // Atoms are sorted along x; the first ones are local and the others are
+    // ghosts
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 4;
+    std::vector<int> order(nb_atoms);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](int i, int j) { return atoms.positions(0, i) < atoms.positions(0, j); });
+    atoms.positions = atoms.positions(Eigen::all, order).eval();
+
+    auto all_pairs{direct_search(atoms.positions, cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero())};
+    for (int nb_ghost_shells : {0, 1, 2}) {
+        // Determine shells from the direct search
+        std::vector<int> shell(nb_atoms, nb_ghost_shells + 1);
+        std::fill(shell.begin(), shell.begin() + nb_local, 0);
+        for (int s{1}; s <= nb_ghost_shells; ++s) {
+            auto previous_shell{shell};
+            for (auto [i, j] : all_pairs) {
+                if (previous_shell[i] == s - 1 && shell[j] > s) shell[j] = s;
+                if (previous_shell[j] == s - 1 && shell[i] > s) shell[i] = s;
+            }
+        }
+
+        // Only pairs between inactive ghosts are missing
+        std::vector<std::tuple<int, int>> expected;
+        std::copy_if(all_pairs.begin(), all_pairs.end(), std::back_inserter(expected), [&](auto pair) {
+            return shell[std::get<0>(pair)] <= nb_ghost_shells || shell[std::get<1>(pair)] <= nb_ghost_shells;
+        });
+        EXPECT_LT(expected.size(), all_pairs.size());
+
+        for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+            NeighborList neighbor_list(storage);
+            neighbor_list.update(atoms, cutoff, 0.0, nb_local, nb_ghost_shells);
+            EXPECT_EQ(sorted_pairs(neighbor_list), expected);
+        }
+    }
+}
+
+
+TEST(NeighborsTest, View) {
+    constexpr int nb_atoms = 300;
+    constexpr double cutoff = 1.3, small_cutoff = 0.9;
+
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 3;
+
+    auto expected{direct_search(atoms.positions, small_cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero())};
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage, 2, true);
+        neighbor_list.update(atoms, cutoff);
+
+        // Rows are sorted by distance
+        for (int i{0}; i < nb_atoms; ++i) {
+            double previous_distance{0};
+            for (int j : neighbor_list.neighbors(i)) {
+                double distance{neighbor_list.distance_vector(atoms.positions, i, j).norm()};
+                EXPECT_LE(previous_distance, distance);
+                previous_distance = distance;
+            }
+        }
+
+        // The view contains the pairs within the smaller cutoff
+        auto view{neighbor_list.view(small_cutoff)};
+        std::vector<std::tuple<int, int>> pairs;
+        view.for_each_pair([&](int i, int j) { pairs.push_back({std::min(i, j), std::max(i, j)}); });
+        std::sort(pairs.begin(), pairs.end());
+        EXPECT_EQ(pairs, expected);
+
+        EXPECT_THROW(neighbor_list.view(1.5 * cutoff), std::runtime_error);
+    }
+
+    // Views require sorted rows
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    EXPECT_THROW(neighbor_list.view(small_cutoff), std::runtime_error);
+}
+
+
+TEST(NeighborsTest, UpdateAtoms) {
+    constexpr int nb_atoms = 300;
+    constexpr double cutoff = 1.3;
+    const Eigen::Array3d domain_length{6, 6, 6};
+
+    for (auto periodicity : {Eigen::Array3i{0, 0, 0}, Eigen::Array3i{1, 1, 0}}) {
+        for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+            for (bool sort_by_distance : {false, true}) {
+                Atoms atoms(nb_atoms);
+                atoms.positions.setRandom();  // random numbers between -1 and 1
+                atoms.positions = 3 * (atoms.positions + 1);
+
+                NeighborList neighbor_list(storage, 2, sort_by_distance);
+                neighbor_list.update(atoms, cutoff, domain_length, periodicity);
+
+                // Move a few atoms, one of them out of the original bounding box
+                Eigen::ArrayXi indices{{3, 17, 18, 250}};
+                for (int m : indices) {
+                    atoms.positions.col(m) += Eigen::Array3d::Random();
+                }
+                atoms.positions(0, 250) = -2;
+                EXPECT_TRUE(neighbor_list.update_atoms(atoms, indices, cutoff));
+                EXPECT_EQ(sorted_pairs(neighbor_list),
+                          direct_search(atoms.positions, cutoff, domain_length, periodicity));
+
+                // Rows remain sorted by distance
+                if (sort_by_distance) {
+                    for (int i{0}; i < nb_atoms; ++i) {
+                        double previous_distance{0};
+                        for (int j : neighbor_list.neighbors(i)) {
+                            double distance{neighbor_list.distance_vector(atoms.positions, i, j).norm()};
+                            EXPECT_LE(previous_distance, distance);
+                            previous_distance = distance;
+                        }
+                    }
+                }
+
+                // Move the same atoms again
+                for (int m : indices) {
+                    atoms.positions.col(m) += 0.1 * Eigen::Array3d::Random();
+                }
+                neighbor_list.update_atoms(atoms, indices, cutoff);
+                EXPECT_EQ(sorted_pairs(neighbor_list),
+                          direct_search(atoms.positions, cutoff, domain_length, periodicity));
+            }
+        }
+    }
+}
+
+
+TEST(NeighborsTest, UpdateAtomsWithSkin) {
+    constexpr int nb_atoms = 300;
+    constexpr double cutoff = 1.3, skin = 0.4;
+
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 3;
+
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff, skin);
+
+    // Moves within half of the skin leave the list untouched
+    Eigen::ArrayXi indices{{5, 6}};
+    atoms.positions(0, 5) += 0.1;
+    EXPECT_FALSE(neighbor_list.update_atoms(atoms, indices, cutoff));
+
+    // Larger moves patch the list, which still contains all pairs within the
+    // cutoff
+    atoms.positions(0, 6) += 1.0;
+    EXPECT_TRUE(neighbor_list.update_atoms(atoms, indices, cutoff));
+    EXPECT_FALSE(neighbor_list.needs_update(atoms, cutoff, skin));
+    auto pairs{sorted_pairs(neighbor_list)};
+    for (auto pair : direct_search(atoms.positions, cutoff, Eigen::Array3d::Zero(), Eigen::Array3i::Zero())) {
+        EXPECT_TRUE(std::binary_search(pairs.begin(), pairs.end(), pair));
+    }
+
+    // Lists with ghost atoms cannot be patched
+    neighbor_list.update(atoms, cutoff, skin, nb_atoms / 2);
+    EXPECT_THROW(neighbor_list.update_atoms(atoms, indices, cutoff), std::runtime_error);
+}
+
+
+#ifdef _OPENMP
+TEST(NeighborsTest, IndependentOfNumberOfThreads) {
+    constexpr int nb_atoms = 1000;
+    constexpr double cutoff = 1.3;
+
+    Atoms atoms(nb_atoms);
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 5;
+
+    // Build list on a single thread
+    int nb_threads{omp_get_max_threads()};
+    omp_set_num_threads(1);
+    NeighborList serial_list;
+    auto &[serial_seed, serial_neighbors]{serial_list.update(atoms, cutoff)};
+
+    // Build list on multiple threads
+    omp_set_num_threads(4);
+    NeighborList parallel_list;
+    auto &[parallel_seed, parallel_neighbors]{parallel_list.update(atoms, cutoff)};
+    omp_set_num_threads(nb_threads);
+
+    // Lists must be identical, including the order of neighbors
+    EXPECT_TRUE((serial_seed == parallel_seed).all());
+    EXPECT_TRUE((serial_neighbors == parallel_neighbors).all());
+}
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "atoms.h"
+#include "ducastelle.h"
+#include "ducastelle_potential.h"
+#include "lennard_jones.h"
+#include "neighbors.h"
+#include "potential.h"
+#include "xyz.h"
+
+/*
+ * Exponential pair repulsion V(r) = A exp(-r / rho), truncated at `cutoff` and
+ * shifted such that it vanishes there
+ */
+class Repulsion : public Potential<Repulsion> {
+  public:
+    Repulsion(double A, double rho, double cutoff)
+        : A_{A}, rho_{rho}, cutoff_{cutoff}, shift_{A * std::exp(-cutoff / rho)} {}
+
+    double cutoff() const { return cutoff_; }
+
+    double accumulate(int, int, double distance, double &d_energy) {
+        const double energy{A_ * std::exp(-distance / rho_)};
+        d_energy -= energy / rho_;
+        return energy - shift_;
+    }
+
+  protected:
+    double A_, rho_, cutoff_, shift_;
+};
+
+TEST(PotentialTest, DucastelleAgreesWithFunction) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    for (auto storage : {NeighborList::Storage::full, NeighborList::Storage::half}) {
+        NeighborList neighbor_list(storage);
+        neighbor_list.update(atoms, cutoff);
+
+        double e_function{ducastelle(atoms, neighbor_list, cutoff)};
+        Forces_t forces_function{atoms.forces};
+        Energies_t energies_function{atoms.energies};
+        EXPECT_NEAR(energies_function.sum(), e_function, 1e-10);
+
+        Ducastelle potential(cutoff);
+        double e{potential.compute(atoms, neighbor_list)};
+        EXPECT_NEAR(e, e_function, 1e-10);
+        EXPECT_TRUE(atoms.forces.isApprox(forces_function, 1e-12));
+        EXPECT_TRUE(atoms.energies.isApprox(energies_function, 1e-12));
+
+        Virial virial_function(true), virial(true);
+        ducastelle(atoms, neighbor_list, virial_function, cutoff);
+        potential.compute(atoms, neighbor_list, virial);
+        EXPECT_TRUE(virial.total.isApprox(virial_function.total, 1e-12));
+        EXPECT_TRUE(virial.per_atom.isApprox(virial_function.per_atom, 1e-12));
+    }
+}
+
+TEST(PotentialTest, SumIsAdditive) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms{names, positions};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+
+    // The repulsion has a smaller cutoff than the list
+    Ducastelle ducastelle(cutoff);
+    Repulsion repulsion(10.0, 0.5, 4.0);
+    LennardJonesWall wall(0.1, 2.0, positions.row(2).minCoeff() - 2.0, 5.0);
+
+    double e_ducastelle{ducastelle.compute(atoms, neighbor_list)};
+    Forces_t forces{atoms.forces};
+    Energies_t energies{atoms.energies};
+    double e_repulsion{repulsion.compute(atoms, neighbor_list)};
+    forces += atoms.forces;
+    energies += atoms.energies;
+    double e_wall{wall.compute(atoms, neighbor_list)};
+    forces += atoms.forces;
+    energies += atoms.energies;
+
+    PotentialSum potential{ducastelle, repulsion, wall};
+    EXPECT_EQ(potential.cutoff(), cutoff);
+    double e{potential.compute(atoms, neighbor_list)};
+    EXPECT_NEAR(e, e_ducastelle + e_repulsion + e_wall, 1e-10);
+    EXPECT_TRUE(atoms.forces.isApprox(forces, 1e-12));
+    EXPECT_TRUE(atoms.energies.isApprox(energies, 1e-12));
+}
+
+TEST(PotentialTest, Forces) {
+    constexpr int nx = 2, ny = 2, nz = 2;
+    constexpr double lattice_constant = 2.5;
+    constexpr double cutoff = 5.0;
+    constexpr double delta = 0.0001;  // difference used for numerical (finite difference) computation of forces
+
+    Atoms atoms(nx * ny * nz);
+
+    // we create a cubic lattice with random displacements
+    atoms.positions.setRandom();  // random numbers between -1 and 1
+    atoms.positions *= 0.1;
+    for (int x{0}, i{0}; x < nx; ++x) {
+        for (int y{0}; y < ny; ++y) {
+            for (int z{0}; z < nz; ++z, ++i) {
+                atoms.positions(0, i) += x * lattice_constant;
+                atoms.positions(1, i) += y * lattice_constant;
+                atoms.positions(2, i) += z * lattice_constant;
+            }
+        }
+    }
+
+    // The wall acts only on the lower layer of atoms
+    PotentialSum potential{Ducastelle(cutoff), Repulsion(10.0, 0.5, 4.0), LennardJonesWall(0.1, 1.0, -2.0, 3.0)};
+    NeighborList neighbor_list;
+    neighbor_list.update(atoms, cutoff);
+    potential.compute(atoms, neighbor_list);
+    Forces_t forces0{atoms.forces};
+
+    // loop over all atoms and compute forces from a finite differences approximation
+    for (int i{0}; i < atoms.nb_atoms(); ++i) {
+        // loop over all Cartesian directions
+        for (int j{0}; j < 3; ++j) {
+            // move atom to the right
+            atoms.positions(j, i) += delta;
+            neighbor_list.update(atoms, cutoff);
+            double eplus{potential.compute(atoms, neighbor_list)};
+            // move atom to the left
+            atoms.positions(j, i) -= 2 * delta;
+            neighbor_list.update(atoms, cutoff);
+            double eminus{potential.compute(atoms, neighbor_list)};
+            // move atom back to original position
+            atoms.positions(j, i) += delta;
+
+            // finite-differences forces
+            double fd_force{-(eplus - eminus) / (2 * delta)};
+
+            // check whether finite-difference and analytic forces agree
+            if (abs(forces0(j, i)) > 1e-10) {
+                EXPECT_NEAR(abs(fd_force - forces0(j, i)) / forces0(j, i), 0, 1e-5);
+            } else {
+                EXPECT_NEAR(fd_force, forces0(j, i), 1e-10);
+            }
+        }
+    }
+}
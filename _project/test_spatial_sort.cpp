@@ -0,0 +1,100 @@
+/*
+* Copyright 2021 Lars Pastewka
+*
+* ### MIT license
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "atoms.h"
+#include "ducastelle.h"
+#include "neighbors.h"
+#include "spatial_sort.h"
+#include "xyz.h"
+
+TEST(SpatialSortTest, MortonOrder) {
+    // Eight atoms at the corners of a cube, listed in reverse Z-order
+    Positions_t positions(3, 8);
+    positions << 1, 0, 1, 0, 1, 0, 1, 0,
+                 1, 1, 0, 0, 1, 1, 0, 0,
+                 1, 1, 1, 1, 0, 0, 0, 0;
+
+    Eigen::ArrayXi permutation{morton_order(positions, 1.0)};
+    EXPECT_TRUE((permutation == Eigen::ArrayXi::LinSpaced(8, 7, 0)).all());
+
+    // All atoms within the same cell keep their order
+    permutation = morton_order(positions, 2.0);
+    EXPECT_TRUE((permutation == Eigen::ArrayXi::LinSpaced(8, 0, 7)).all());
+}
+
+TEST(SpatialSortTest, ReorderAndRestore) {
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms(names, positions);
+    const Eigen::Index nb_atoms{atoms.nb_atoms()};
+    atoms.masses = Eigen::ArrayXd::LinSpaced(nb_atoms, 0, nb_atoms - 1);
+    atoms.velocities = 2 * positions;
+    atoms.forces = 3 * positions;
+    atoms.energies = 4 * atoms.masses;
+
+    Eigen::ArrayXi permutation{sort_atoms(atoms, 5.0)};
+
+    // Permutation contains every atom exactly once
+    Eigen::ArrayXi sorted_permutation{permutation};
+    std::sort(sorted_permutation.begin(), sorted_permutation.end());
+    EXPECT_TRUE((sorted_permutation == Eigen::ArrayXi::LinSpaced(nb_atoms, 0, nb_atoms - 1)).all());
+
+    // All per-atom properties have been moved consistently
+    EXPECT_TRUE((atoms.masses == permutation.cast<double>()).all());
+    EXPECT_TRUE((atoms.positions == positions(Eigen::all, permutation)).all());
+    EXPECT_TRUE((atoms.velocities == 2 * atoms.positions).all());
+    EXPECT_TRUE((atoms.forces == 3 * atoms.positions).all());
+    EXPECT_TRUE((atoms.energies == 4 * atoms.masses).all());
+
+    // Restore original order
+    reorder_atoms(atoms, inverse_permutation(permutation));
+    EXPECT_TRUE((atoms.masses == Eigen::ArrayXd::LinSpaced(nb_atoms, 0, nb_atoms - 1)).all());
+    EXPECT_TRUE((atoms.positions == positions).all());
+}
+
+TEST(SpatialSortTest, DucastelleIndependentOfOrder) {
+    constexpr double cutoff = 5.0;
+
+    auto [names, positions]{read_xyz("cluster_923.xyz")};
+    Atoms atoms(names, positions);
+    NeighborList neighbor_list;
+
+    neighbor_list.update(atoms, cutoff);
+    double energy_ref{ducastelle(atoms, neighbor_list, cutoff)};
+    Forces_t forces_ref{atoms.forces};
+
+    // Sort twice to check that keeping track of the original index works
+    const Eigen::Index nb_atoms{atoms.nb_atoms()};
+    Eigen::ArrayXi original_index{Eigen::ArrayXi::LinSpaced(nb_atoms, 0, nb_atoms - 1)};
+    original_index = original_index(sort_atoms(atoms, cutoff)).eval();
+    atoms.positions.colwise() += Eigen::Array3d{1.3, -0.7, 2.1};
+    original_index = original_index(sort_atoms(atoms, cutoff / 2)).eval();
+
+    neighbor_list.update(atoms, cutoff);
+    atoms.forces.setZero();
+    EXPECT_NEAR(ducastelle(atoms, neighbor_list, cutoff), energy_ref, 1e-9);
+    EXPECT_TRUE(atoms.forces.isApprox(forces_ref(Eigen::all, original_index), 1e-9));
+}
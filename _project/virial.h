@@ -0,0 +1,124 @@
+/*
+ * Copyright 2021 Lars Pastewka
+ *
+ * ### MIT license
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef YAMD_VIRIAL_H
+#define YAMD_VIRIAL_H
+
+#include <Eigen/Dense>
+
+/*
+ * Virial of the interatomic forces,
+ *     W = sum_pairs r_ij (x) f_ij,
+ * where r_ij = r_i - r_j and f_ij is the force that atom j exerts on atom i.
+ * The stress tensor of a system of volume V is
+ *     sigma = -(sum_i m_i v_i (x) v_i + W) / V,
+ * with tensile stresses positive. Potentials that accept a `Virial`
+ * overwrite `total` and, if `compute_per_atom` is set, `per_atom` in the same
+ * loop that computes the forces. The virial of every pair is split evenly
+ * between its two atoms, hence the per-atom virials of all atoms sum to the
+ * total.
+ *
+ * Under domain decomposition, set `nb_local` to the number of process-local
+ * atoms (see `Domain::nb_local`). Pairs between a local atom and a ghost then
+ * count with a weight of 1/2 and pairs between two ghosts are ignored, such
+ * that `total` equals the sum of the per-atom virials of the local atoms and
+ * the sum of `total` over all processes is the virial of the whole system.
+ */
+struct Virial {
+    // Per-atom virials; column i holds the tensor of atom i in column-major
+    // order
+    using PerAtom = Eigen::Array<double, 9, Eigen::Dynamic>;
+
+    explicit Virial(bool compute_per_atom = false) : compute_per_atom{compute_per_atom} {}
+
+    // Total virial
+    Eigen::Matrix3d total{Eigen::Matrix3d::Zero()};
+
+    // Compute per-atom virials
+    bool compute_per_atom;
+
+    PerAtom per_atom;
+
+    // Atoms starting at `nb_local` are ghosts; all atoms are local if this
+    // is negative
+    int nb_local{-1};
+
+    /*
+     * Return the virial of atom `i` as a 3x3 matrix
+     */
+    Eigen::Map<const Eigen::Matrix3d> atom(int i) const {
+        return Eigen::Map<const Eigen::Matrix3d>(per_atom.col(i).data());
+    }
+
+    /*
+     * Zero the total and, if requested, the per-atom virials of `nb_atoms`
+     * atoms
+     */
+    void reset(int nb_atoms) {
+        total.setZero();
+        if (compute_per_atom)
+            per_atom.setZero(9, nb_atoms);
+    }
+
+    /*
+     * Weight of the pair (i, j) in `total`: 1 if both atoms are local, 1/2 if
+     * one of them is a ghost and 0 if both are ghosts
+     */
+    double weight(int i, int j) const {
+        if (nb_local < 0)
+            return 1;
+        return 0.5 * ((i < nb_local) + (j < nb_local));
+    }
+
+    /*
+     * Virial r_ij (x) f_ij of a pair, where `distance_vector` is r_i - r_j and
+     * `pair_force` is the force on atom j, i.e. the force on atom i is
+     * -`pair_force`
+     */
+    static Eigen::Matrix3d pair(const Eigen::Array3d &distance_vector, const Eigen::Array3d &pair_force) {
+        return -distance_vector.matrix() * pair_force.matrix().transpose();
+    }
+
+    /*
+     * Add `virial` to atom `i` of the per-atom virials `per_atom`
+     */
+    static void add_atom(PerAtom &per_atom, int i, const Eigen::Matrix3d &virial) {
+        Eigen::Map<Eigen::Matrix3d>(per_atom.col(i).data()) += virial;
+    }
+
+    /*
+     * Add the virial of the pair (i, j) to `total` and split it evenly between
+     * the per-atom virials of both atoms
+     */
+    void add_pair(int i, int j, const Eigen::Array3d &distance_vector, const Eigen::Array3d &pair_force) {
+        const Eigen::Matrix3d pair_virial{pair(distance_vector, pair_force)};
+        total += weight(i, j) * pair_virial;
+        if (compute_per_atom) {
+            add_atom(per_atom, i, 0.5 * pair_virial);
+            add_atom(per_atom, j, 0.5 * pair_virial);
+        }
+    }
+};
+
+#endif  // YAMD_VIRIAL_H
@@ -109,9 +109,12 @@ void write_xyz(std::ofstream &file, Atoms &atoms) {
     // Comment line
     file << std::endl;
 
-    // Element name, position
+    // Element name, position; atoms without (a complete set of) names are
+    // written as gold
+    const bool has_names{static_cast<int>(atoms.names.size()) ==
+                         static_cast<int>(atoms.nb_atoms())};
     for (int i = 0; i < atoms.nb_atoms(); ++i) {
-        file << std::setw(2) << "Au" << " "
+        file << std::setw(2) << (has_names ? atoms.names[i] : "Au") << " "
              << std::setw(10) << atoms.positions.col(i).transpose()
              << std::setw(10) << atoms.velocities.col(i).transpose()
              << std::endl;